@@ -0,0 +1,234 @@
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <string>
+#include <cstdio>
+
+#include <benchmark/benchmark.h>
+#include <glm/glm.hpp>
+#include <omp.h>
+#include <cyCodeBase/cyPointCloud.h>
+
+#include "common.hpp"
+#include "solver.hpp"
+#include "collision_handler.hpp"
+#include "rand_generator.hpp"
+#include "particle_exporter.hpp"
+
+// Microbenchmarks for the SPH kernels, the k-d tree, every Solver phase and the exporters.
+// Every benchmark takes Args({particle count, OpenMP thread count}).
+//
+//   sph_benchmark --benchmark_format=json --benchmark_out=results.json
+//   sph_benchmark --benchmark_filter='phase/.*/100000/'
+//
+// The particle count is rounded to num_particle_each_side^2 as in SimulationConfig.
+// Link: -fopenmp -lbenchmark -ltbb (no GLFW / glad).
+
+static void particle_count_args(benchmark::internal::Benchmark *b)
+{
+    int max_thread = omp_get_max_threads();
+    for (long n : {10000, 100000, 1000000, 2000000})
+    {
+        for (int t = 1; t <= max_thread; t *= 2) b->Args({n, t});
+        if ((max_thread & (max_thread - 1)) != 0) b->Args({n, max_thread});
+    }
+    b->UseRealTime()->Unit(benchmark::kMicrosecond);
+}
+
+// Reconfigures the scene for n particles. The solver is kept between benchmarks with
+// the same particle count because constructing one at 2M particles dominates a short run.
+static Solver &get_solver(long n)
+{
+    static std::unique_ptr<Solver> solver;
+    static long configured = -1;
+
+    if (configured != n)
+    {
+        solver.reset();
+        SimulationConfig config;
+        config.num_particle_each_side = std::lround(std::sqrt((double)n));
+        apply_simulation_config(config);
+        configured = n;
+
+        solver.reset(new Solver());
+        solver->get_profiler().set_enabled(false);
+        solver->compute_next_state();   // neighbourhood, density and forces become valid
+    }
+    return *solver;
+}
+
+static std::vector<glm::vec3> random_offsets(long n)
+{
+    RandGenerator rand_generator;
+    std::vector<glm::vec3> r(n);
+    for (long i = 0; i < n; i++) r[i] = rand_generator.generate_random_uniform_vec3(-k_sph_s, k_sph_s);
+    return r;
+}
+
+static void set_threads(benchmark::State &state)
+{
+    omp_set_num_threads(state.range(1));
+}
+
+// Kernels -----------------------------------------------------------------//
+template <typename Result, Result (*KernelFunc)(glm::vec3)>
+static void bm_kernel(benchmark::State &state)
+{
+    set_threads(state);
+    get_solver(state.range(0));
+    const long n = k_num_particle;
+    std::vector<glm::vec3> r = random_offsets(n);
+    std::vector<Result> out(n);
+    for (auto _ : state)
+    {
+        #pragma omp parallel for
+        for (long i = 0; i < n; i++) out[i] = KernelFunc(r[i]);
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK_TEMPLATE(bm_kernel, float, sph_default_kernel)->Name("kernel/default")->Apply(particle_count_args);
+BENCHMARK_TEMPLATE(bm_kernel, glm::vec3, sph_default_kernel_gradient)->Name("kernel/default_gradient")->Apply(particle_count_args);
+BENCHMARK_TEMPLATE(bm_kernel, float, sph_default_kernel_laplacian)->Name("kernel/default_laplacian")->Apply(particle_count_args);
+BENCHMARK_TEMPLATE(bm_kernel, glm::vec3, sph_pressure_kernel_gradient)->Name("kernel/pressure_gradient")->Apply(particle_count_args);
+BENCHMARK_TEMPLATE(bm_kernel, float, sph_diffusion_kernel_laplacian)->Name("kernel/diffusion_laplacian")->Apply(particle_count_args);
+
+// k-d tree ----------------------------------------------------------------//
+static void bm_kdtree_build(benchmark::State &state)
+{
+    set_threads(state);
+    Particle &particles = get_solver(state.range(0)).get_particles();
+    cy::PointCloud<glm::vec3, float, 3> kdtree;
+    for (auto _ : state)
+    {
+        kdtree.Build(k_num_particle, particles.next_position.data());
+    }
+    state.SetItemsProcessed(state.iterations() * k_num_particle);
+}
+BENCHMARK(bm_kdtree_build)->Name("kdtree/build")->Apply(particle_count_args);
+
+static void bm_kdtree_get_points(benchmark::State &state)
+{
+    set_threads(state);
+    Particle &particles = get_solver(state.range(0)).get_particles();
+    cy::PointCloud<glm::vec3, float, 3> kdtree;
+    kdtree.Build(k_num_particle, particles.next_position.data());
+    std::vector<unsigned int> found(k_num_particle);
+    for (auto _ : state)
+    {
+        #pragma omp parallel for
+        for (int i = 0; i < (int)k_num_particle; i++)
+        {
+            found[i] = 0;
+            kdtree.GetPoints(i, particles.next_position[i], k_sph_s,
+                [&found](unsigned int target, unsigned int, glm::vec3 const &, float, float &) { found[target]++; });
+        }
+        benchmark::DoNotOptimize(found.data());
+    }
+    state.SetItemsProcessed(state.iterations() * k_num_particle);
+}
+BENCHMARK(bm_kdtree_get_points)->Name("kdtree/get_points")->Apply(particle_count_args);
+
+// Solver phases -----------------------------------------------------------//
+static void bm_phase(benchmark::State &state, profiler::phase p)
+{
+    set_threads(state);
+    Solver &solver = get_solver(state.range(0));
+    for (auto _ : state)
+    {
+        solver.run_phase(p);
+    }
+    state.SetItemsProcessed(state.iterations() * k_num_particle);
+}
+BENCHMARK_CAPTURE(bm_phase, neighborhood, profiler::neighborhood)->Name("phase/neighborhood")->Apply(particle_count_args);
+BENCHMARK_CAPTURE(bm_phase, density, profiler::density)->Name("phase/density")->Apply(particle_count_args);
+BENCHMARK_CAPTURE(bm_phase, pressure, profiler::pressure)->Name("phase/pressure")->Apply(particle_count_args);
+BENCHMARK_CAPTURE(bm_phase, force_pressure, profiler::force_pressure)->Name("phase/force_pressure")->Apply(particle_count_args);
+BENCHMARK_CAPTURE(bm_phase, force_diffusion, profiler::force_diffusion)->Name("phase/force_diffusion")->Apply(particle_count_args);
+BENCHMARK_CAPTURE(bm_phase, force_gravity, profiler::force_gravity)->Name("phase/force_gravity")->Apply(particle_count_args);
+BENCHMARK_CAPTURE(bm_phase, force_surface_tension, profiler::force_surface_tension)->Name("phase/force_surface_tension")->Apply(particle_count_args);
+BENCHMARK_CAPTURE(bm_phase, collision, profiler::collision)->Name("phase/collision")->Apply(particle_count_args);
+
+static void bm_step(benchmark::State &state)
+{
+    set_threads(state);
+    Solver &solver = get_solver(state.range(0));
+    for (auto _ : state)
+    {
+        solver.compute_next_state();
+    }
+    state.SetItemsProcessed(state.iterations() * k_num_particle);
+}
+BENCHMARK(bm_step)->Name("solver/compute_next_state")->Apply(particle_count_args);
+
+// Collision ---------------------------------------------------------------//
+static void bm_detect_collision(benchmark::State &state)
+{
+    set_threads(state);
+    Particle &particles = get_solver(state.range(0)).get_particles();
+    const int n = k_num_particle;
+    std::vector<int> hit(n);
+    for (auto _ : state)
+    {
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+        {
+            collision::result ret = collision::detect_collision(particles.position[i], particles.next_position[i],
+                                                                particles.velocity[i], particles.next_velocity[i]);
+            hit[i] = ret != collision::null_result;
+        }
+        benchmark::DoNotOptimize(hit.data());
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(bm_detect_collision)->Name("collision/detect_collision")->Apply(particle_count_args);
+
+// Export ------------------------------------------------------------------//
+// A single size: an export is one pass over the particles, so 1M shows the
+// serialization throughput and the file write.
+static void export_args(benchmark::internal::Benchmark *b)
+{
+    int max_thread = omp_get_max_threads();
+    for (int t = 1; t <= max_thread; t *= 2) b->Args({1000000, t});
+    if ((max_thread & (max_thread - 1)) != 0) b->Args({1000000, max_thread});
+    b->UseRealTime()->Unit(benchmark::kMillisecond);
+}
+
+// Serializes a frame into the exporter's buffer; with write, also writes it to a
+// file in the working directory, which is removed afterwards.
+static void bm_export(benchmark::State &state, ParticleExporter::format f, bool write)
+{
+    set_threads(state);
+    Particle &particles = get_solver(state.range(0)).get_particles();
+    const char *extension[] = {".vtk", ".vtu", ".ply"};
+    const std::string path = std::string("sph_benchmark_export") + extension[f];
+    ParticleExporter exporter;
+    for (auto _ : state)
+    {
+        if (write)
+        {
+            if (!exporter.write(path, particles))
+            {
+                state.SkipWithError("export write failed");
+                break;
+            }
+        }
+        else
+        {
+            exporter.serialize(f, particles.get_num_active(), particles.position, particles.velocity, particles.density, particles.pressure);
+        }
+        benchmark::DoNotOptimize(exporter.data());
+    }
+    if (write) std::remove(path.c_str());
+    state.SetItemsProcessed(state.iterations() * particles.get_num_active());
+    state.SetBytesProcessed(state.iterations() * exporter.size());
+}
+BENCHMARK_CAPTURE(bm_export, vtk_serialize, ParticleExporter::format::vtk, false)->Name("export/vtk/serialize")->Apply(export_args);
+BENCHMARK_CAPTURE(bm_export, vtu_serialize, ParticleExporter::format::vtu, false)->Name("export/vtu/serialize")->Apply(export_args);
+BENCHMARK_CAPTURE(bm_export, ply_serialize, ParticleExporter::format::ply, false)->Name("export/ply/serialize")->Apply(export_args);
+BENCHMARK_CAPTURE(bm_export, vtk_write, ParticleExporter::format::vtk, true)->Name("export/vtk/write")->Apply(export_args);
+BENCHMARK_CAPTURE(bm_export, vtu_write, ParticleExporter::format::vtu, true)->Name("export/vtu/write")->Apply(export_args);
+BENCHMARK_CAPTURE(bm_export, ply_write, ParticleExporter::format::ply, true)->Name("export/ply/write")->Apply(export_args);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "headless_runner.hpp"
+#include "scaling_benchmark.hpp"
+#include "common.hpp"
+#include "force_field_grid.hpp"
+#include "velocity_field.hpp"
+
+const char k_headless_usage[] = "[--steps N] [--time SEC] [--report SEC] [--resume FILE] [--checkpoint FILE] [--record FILE] [--trajectory FILE] [--export PATTERN] [--mesh PATTERN] [--profile PREFIX] [--counters] "
+                                "[--scaling MAX_THREADS] [--scaling-csv FILE] [--bake-force-field FILE] "
+                                "[--config FILE] [key=value ...]";
+
+// Writes a keyframed force field for `force_field = FILE`: the electric field turning
+// once about the vertical axis through the box centre over max_display_time, one
+// keyframe per second.
+static bool bake_force_field(const std::string &path)
+{
+    const unsigned int num_interval = std::max(k_max_display_time, 1u);
+    ForceFieldKeyframeWriter writer;
+    if (!writer.open(path, k_force_field_grid_resolution, 1.0f)) return false;
+    ForceFieldGrid grid;
+    const glm::vec3 center = glm::vec3(0.5f * k_world_edge_size);
+    for (unsigned int k = 0; k <= num_interval; k++)
+    {
+        const float angle = 2.0f * M_PI * k / num_interval;
+        const float c = std::cos(angle), s = std::sin(angle);
+        grid.bake([&](glm::vec3 pos) {
+            glm::vec3 r = pos - center;
+            glm::vec3 e = velocity_field::electric_field(center + glm::vec3(c * r.x + s * r.y, -s * r.x + c * r.y, r.z));
+            return glm::vec3(c * e.x - s * e.y, s * e.x + c * e.y, e.z);
+        });
+        if (!writer.append(grid)) return false;
+    }
+    if (!writer.close()) return false;
+    std::cout << "force field written to " << path << " (" << num_interval + 1 << " keyframes)" << std::endl;
+    return true;
+}
+
+// Links against OpenMP and TBB only; no GLFW / glad.
+int main(int argc, char **argv) 
+{
+    HeadlessOptions options;
+    SimulationConfig config;
+    ScalingOptions scaling_options;
+    bool scaling = false;
+    std::string bake_force_field_path;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--steps") options.max_step = std::strtoul(argv[++i], NULL, 10);
+        else if (i + 1 < argc && arg == "--time") options.max_time = std::strtof(argv[++i], NULL);
+        else if (i + 1 < argc && arg == "--report") options.report_interval = std::strtof(argv[++i], NULL);
+        else if (i + 1 < argc && arg == "--resume") options.resume_path = argv[++i];
+        else if (i + 1 < argc && arg == "--checkpoint") options.checkpoint_path = argv[++i];
+        else if (i + 1 < argc && arg == "--record") options.record_path = argv[++i];
+        else if (i + 1 < argc && arg == "--trajectory") options.trajectory_path = argv[++i];
+        else if (i + 1 < argc && arg == "--profile") options.profile_prefix = argv[++i];
+        else if (i + 1 < argc && arg == "--export") options.export_pattern = argv[++i];
+        else if (i + 1 < argc && arg == "--mesh") options.mesh_pattern = argv[++i];
+        else if (arg == "--counters") options.counters = true;
+        else if (i + 1 < argc && arg == "--scaling")
+        {
+            scaling = true;
+            scaling_options.max_thread = std::atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && arg == "--scaling-csv") scaling_options.csv_path = argv[++i];
+        else if (i + 1 < argc && arg == "--bake-force-field") bake_force_field_path = argv[++i];
+        else if (!config.parse_argument(i, argc, argv))
+        {
+            std::cout << "Usage: " << argv[0] << " " << k_headless_usage << std::endl;
+            return 1;
+        }
+    }
+    if (!apply_simulation_config(config)) return 1;
+
+    if (!bake_force_field_path.empty()) return bake_force_field(bake_force_field_path) ? 0 : 1;
+
+    if (scaling)
+    {
+        if (options.max_step > 0) scaling_options.num_step = options.max_step;
+        ScalingBenchmark benchmark;
+        return benchmark.run(config, scaling_options) ? 0 : 1;
+    }
+
+    HeadlessRunner runner;
+    if (!runner.run(options)) return 1;
+
+	return 0;
+}
@@ -0,0 +1,377 @@
+#ifndef FRAME_CAPTURE_HPP_
+#define FRAME_CAPTURE_HPP_
+
+#include <vector>
+#include <array>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include <glad/glad.h>
+
+// Image files without external libraries. Both take RGBA rows bottom-up, as read back
+// from GL, and write RGB top-down.
+namespace image_file
+{
+
+inline bool write_ppm(const std::string &path, int width, int height, const uint8_t *rgba)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<uint8_t> row(3 * width);
+    for (int y = height - 1; y >= 0; y--)
+    {
+        const uint8_t *src = rgba + (size_t)4 * width * y;
+        for (int x = 0; x < width; x++) std::memcpy(&row[3 * x], &src[4 * x], 3);
+        file.write(reinterpret_cast<const char *>(row.data()), row.size());
+    }
+    return file.good();
+}
+
+inline uint32_t crc32(const uint8_t *p, size_t n, uint32_t crc = 0)
+{
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// LSB-first bit stream of a deflate block
+struct bit_writer
+{
+    std::vector<uint8_t> &out;
+    uint32_t bits = 0;
+    int count = 0;
+
+    explicit bit_writer(std::vector<uint8_t> &o) : out(o) {}
+
+    void put(uint32_t value, int n)
+    {
+        bits |= value << count;
+        count += n;
+        while (count >= 8)
+        {
+            out.push_back(bits & 0xff);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    // Huffman codes are stored most significant bit first
+    void put_code(uint32_t code, int n)
+    {
+        uint32_t r = 0;
+        for (int i = 0; i < n; i++) r |= ((code >> i) & 1) << (n - 1 - i);
+        put(r, n);
+    }
+
+    void flush() { if (count > 0) put(0, 8 - count); }
+};
+
+// zlib stream of one fixed-Huffman deflate block. The only back-reference is to the
+// previous pixel (distance 3), i.e. run-length coding of identical pixels, which is
+// what the flat background and box walls of a rendered frame need; it is fast enough
+// for the encoder threads to keep up with the display rate.
+inline void deflate_rgb_rows(const std::vector<uint8_t> &raw, std::vector<uint8_t> &out)
+{
+    static const uint16_t length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                             35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                             3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    out.push_back(0x78);
+    out.push_back(0x01);
+    bit_writer w(out);
+    w.put(1, 1);    // final block
+    w.put(1, 2);    // fixed Huffman codes
+
+    auto put_symbol = [&w](unsigned int s) {
+        if (s < 144) w.put_code(0x30 + s, 8);
+        else if (s < 256) w.put_code(0x190 + s - 144, 9);
+        else if (s < 280) w.put_code(s - 256, 7);
+        else w.put_code(0xc0 + s - 280, 8);
+    };
+
+    const size_t n = raw.size();
+    size_t i = 0;
+    while (i < n)
+    {
+        size_t run = 0;
+        if (i >= 3) while (run < 258 && i + run < n && raw[i + run] == raw[i + run - 3]) run++;
+        if (run < 3)
+        {
+            put_symbol(raw[i++]);
+            continue;
+        }
+        int c = 28;
+        while (length_base[c] > run) c--;
+        put_symbol(257 + c);
+        w.put(run - length_base[c], length_extra[c]);
+        w.put_code(2, 5);   // distance 3
+        i += run;
+    }
+    put_symbol(256);
+    w.flush();
+
+    uint32_t a = 1, b = 0;
+    for (uint8_t v : raw)
+    {
+        a = (a + v) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint32_t adler = (b << 16) | a;
+    for (int k = 3; k >= 0; k--) out.push_back((adler >> (8 * k)) & 0xff);
+}
+
+inline bool write_png(const std::string &path, int width, int height, const uint8_t *rgba)
+{
+    std::vector<uint8_t> raw((size_t)(3 * width + 1) * height);
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t *dst = &raw[(size_t)(3 * width + 1) * y];
+        const uint8_t *src = rgba + (size_t)4 * width * (height - 1 - y);
+        *dst++ = 0;     // filter: none
+        for (int x = 0; x < width; x++) std::memcpy(&dst[3 * x], &src[4 * x], 3);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+    auto put_chunk = [&file](const char *type, const std::vector<uint8_t> &data) {
+        std::vector<uint8_t> c(type, type + 4);
+        c.insert(c.end(), data.begin(), data.end());
+        uint32_t size = data.size(), crc = crc32(c.data(), c.size());
+        const uint8_t head[4] = {uint8_t(size >> 24), uint8_t(size >> 16), uint8_t(size >> 8), uint8_t(size)};
+        const uint8_t tail[4] = {uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc)};
+        file.write(reinterpret_cast<const char *>(head), 4);
+        file.write(reinterpret_cast<const char *>(c.data()), c.size());
+        file.write(reinterpret_cast<const char *>(tail), 4);
+    };
+
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    file.write(reinterpret_cast<const char *>(signature), 8);
+    std::vector<uint8_t> header = {uint8_t(width >> 24), uint8_t(width >> 16), uint8_t(width >> 8), uint8_t(width),
+                                   uint8_t(height >> 24), uint8_t(height >> 16), uint8_t(height >> 8), uint8_t(height),
+                                   8, 2, 0, 0, 0};      // 8-bit RGB
+    put_chunk("IHDR", header);
+    std::vector<uint8_t> data;
+    deflate_rgb_rows(raw, data);
+    put_chunk("IDAT", data);
+    put_chunk("IEND", {});
+    return file.good();
+}
+
+} // namespace image_file
+
+
+// Writes every grabbed frame to an image file without stalling the render loop.
+// glReadPixels goes into a ring of k_num_slot pixel-pack buffers, each guarded by a
+// fence, and a slot is mapped only once its fence has signalled (or when the ring is
+// full, i.e. the GPU is k_num_slot frames behind). The mapped pixels are copied into
+// an image from a free-list and handed to k_num_encoder threads, which flip, encode
+// and write the file. If encoding falls behind, images queue up in memory instead.
+class FrameCapture
+{
+private:
+    struct image
+    {
+        std::string path;
+        int width;
+        int height;
+        std::vector<uint8_t> rgba;
+    };
+
+    struct slot
+    {
+        GLuint buffer;
+        GLsync fence;
+        size_t capacity;
+        int width;
+        int height;
+        unsigned int frame;
+    };
+
+    static const unsigned int k_num_slot = 3;
+    static const unsigned int k_num_encoder = 2;
+
+    std::string pattern_;       // printf pattern with the frame number, e.g. frame_%05d.png
+    bool png_;
+    unsigned int num_frame_;
+    slot slot_[k_num_slot];
+    std::deque<unsigned int> pending_;      // slots with a read in flight, oldest first
+
+    std::vector<std::thread> encoder_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<image *> queue_;
+    std::vector<image *> free_;
+    bool closing_;
+
+public:
+    FrameCapture()
+    : png_(false)
+    , num_frame_(0)
+    , slot_{}
+    , closing_(false)
+    {
+    };
+
+    // Needs a current GL context; path is a .png or .ppm pattern.
+    bool open(const std::string &pattern)
+    {
+        const std::string ext = pattern.size() > 4 ? pattern.substr(pattern.size() - 4) : "";
+        if (ext != ".png" && ext != ".ppm")
+        {
+            std::cout << "Unknown capture format: " << pattern << std::endl;
+            return false;
+        }
+        pattern_ = pattern;
+        png_ = ext == ".png";
+        num_frame_ = 0;
+        for (slot &s : slot_)
+        {
+            glGenBuffers(1, &s.buffer);
+            s.fence = 0;
+            s.capacity = 0;
+        }
+        closing_ = false;
+        for (unsigned int t = 0; t < k_num_encoder; t++) encoder_.emplace_back(&FrameCapture::consume, this);
+        return true;
+    }
+
+    bool is_open() const { return !encoder_.empty(); }
+    unsigned int get_num_frame() const { return num_frame_; }
+
+    // Queues a read of the color buffer of `framebuffer` (0: the back buffer).
+    void grab(GLuint framebuffer, int width, int height)
+    {
+        while (!pending_.empty() && retire(pending_.front(), false)) pending_.pop_front();
+        if (pending_.size() == k_num_slot)
+        {
+            retire(pending_.front(), true);
+            pending_.pop_front();
+        }
+
+        const unsigned int k = num_frame_ % k_num_slot;
+        slot &s = slot_[k];
+        const size_t bytes = (size_t)4 * width * height;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glReadBuffer(framebuffer == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+        if (s.capacity < bytes)
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+            s.capacity = bytes;
+        }
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        s.width = width;
+        s.height = height;
+        s.frame = num_frame_++;
+        pending_.push_back(k);
+    }
+
+    // Collects the reads still in flight (needs the GL context), then waits for the
+    // encoders to write every queued image.
+    void close()
+    {
+        if (!is_open()) return;
+        for (unsigned int k : pending_) retire(k, true);
+        pending_.clear();
+        for (slot &s : slot_) glDeleteBuffers(1, &s.buffer);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closing_ = true;
+        }
+        cv_.notify_all();
+        for (std::thread &t : encoder_) t.join();
+        encoder_.clear();
+        for (image *i : free_) delete i;
+        free_.clear();
+    }
+
+    ~FrameCapture() {};
+
+private:
+    // Moves the pixels of slot k to the encoders; false if its read is not done and !wait.
+    bool retire(unsigned int k, bool wait)
+    {
+        slot &s = slot_[k];
+        GLenum status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000ull : 0);
+        if (status == GL_TIMEOUT_EXPIRED && !wait) return false;
+        glDeleteSync(s.fence);
+        s.fence = 0;
+
+        image *img = NULL;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty())
+            {
+                img = free_.back();
+                free_.pop_back();
+            }
+        }
+        if (!img) img = new image();
+
+        char path[1024];
+        std::snprintf(path, sizeof(path), pattern_.c_str(), s.frame);
+        img->path = path;
+        img->width = s.width;
+        img->height = s.height;
+        const size_t bytes = (size_t)4 * s.width * s.height;
+        img->rgba.resize(bytes);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+        const void *src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (src) std::memcpy(img->rgba.data(), src, bytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(img);
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+    void consume()
+    {
+        while (true)
+        {
+            image *img;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return closing_ || !queue_.empty(); });
+                if (queue_.empty()) return;
+                img = queue_.front();
+                queue_.pop_front();
+            }
+
+            bool ok = png_ ? image_file::write_png(img->path, img->width, img->height, img->rgba.data())
+                           : image_file::write_ppm(img->path, img->width, img->height, img->rgba.data());
+            if (!ok) std::cout << "Failed to write frame: " << img->path << std::endl;
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_.push_back(img);
+        }
+    }
+};
+
+#endif // FRAME_CAPTURE_HPP_
@@ -6,35 +6,9 @@
 namespace GLObj
 {
 
-// float br = 0.02; // ball radius
-float br = k_particle_radius / (k_world_edge_size / 1.5);
-float particle[] = {
-    // positions 
-     br,  0,  0, // triangle 1
-      0, br,  0,  
-      0,  0, br,
-      0, br,  0, // triangle 2
-    -br,  0,  0,
-      0,  0, br,
-    -br,  0,  0, // triangle 3
-      0,-br,  0,
-      0,  0, br,
-      0,-br,  0, // triangle 4
-     br,  0,  0,
-      0,  0, br,
-     br,  0,  0, // triangle 5
-      0,-br,  0,
-      0,  0,-br,
-      0,-br,  0, // triangle 6
-    -br,  0,  0,
-      0,  0,-br,
-    -br,  0,  0, // triangle 7
-      0, br,  0,
-      0,  0,-br,
-      0, br,  0, // triangle 8
-     br,  0,  0,
-      0,  0,-br,
-};
+// sphere sprite radius in GL units: the rest spacing, so neighbouring spheres overlap and
+// the smoothed depth closes into a surface; the scene is configured at runtime
+inline float particle_radius() { return std::cbrt(k_fluid_volume / k_num_particle) * 2.0f / k_world_edge_size; }
 
 float box[] = {
     // positions         // colors
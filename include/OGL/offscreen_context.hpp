@@ -0,0 +1,105 @@
+#ifndef OFFSCREEN_CONTEXT_HPP_
+#define OFFSCREEN_CONTEXT_HPP_
+
+#include <iostream>
+#include <vector>
+
+#include <EGL/egl.h>
+
+// From eglext.h, which needs a newer KHR/khrplatform.h than the one that comes with glad.
+typedef void *EGLDeviceEXT;
+typedef EGLDisplay (EGLAPIENTRYP get_platform_display_proc)(EGLenum platform, void *native_display, const EGLint *attrib_list);
+typedef EGLBoolean (EGLAPIENTRYP query_devices_proc)(EGLint max_devices, EGLDeviceEXT *devices, EGLint *num_devices);
+const EGLenum k_egl_platform_device = 0x313F;           // EGL_PLATFORM_DEVICE_EXT
+const EGLenum k_egl_platform_surfaceless = 0x31DD;      // EGL_PLATFORM_SURFACELESS_MESA
+
+// Windowless GL context through EGL, for machines without a display server. The
+// context has no surface (EGL_KHR_surfaceless_context); the renderer draws into its
+// own framebuffer object. Displays are tried in order: a GPU through
+// EGL_EXT_platform_device, Mesa's surfaceless platform (software rasterizer on
+// machines without a GPU), then the default display.
+class OffscreenContext
+{
+private:
+    EGLDisplay display_;
+    EGLContext context_;
+
+public:
+    OffscreenContext()
+    : display_(EGL_NO_DISPLAY)
+    , context_(EGL_NO_CONTEXT)
+    {
+    };
+
+    bool create(int major, int minor)
+    {
+        EGLConfig config;
+        if (!open_display(config))
+        {
+            std::cout << "Failed to open an EGL display with an OpenGL config" << std::endl;
+            return false;
+        }
+        eglBindAPI(EGL_OPENGL_API);
+        const EGLint context_attrib[] = {EGL_CONTEXT_MAJOR_VERSION, major, EGL_CONTEXT_MINOR_VERSION, minor,
+                                         EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+        context_ = eglCreateContext(display_, config, EGL_NO_CONTEXT, context_attrib);
+        if (context_ == EGL_NO_CONTEXT || !eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_))
+        {
+            std::cout << "Failed to create EGL context (error 0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+            destroy();
+            return false;
+        }
+        return true;
+    }
+
+    static void *get_proc_address(const char *name) { return (void *)eglGetProcAddress(name); }
+
+    void destroy()
+    {
+        if (display_ == EGL_NO_DISPLAY) return;
+        eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context_ != EGL_NO_CONTEXT) eglDestroyContext(display_, context_);
+        eglTerminate(display_);
+        context_ = EGL_NO_CONTEXT;
+        display_ = EGL_NO_DISPLAY;
+    }
+
+    ~OffscreenContext() { destroy(); };
+
+private:
+    bool open_display(EGLConfig &config)
+    {
+        std::vector<EGLDisplay> candidate;
+        auto get_platform_display = (get_platform_display_proc)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        auto query_devices = (query_devices_proc)eglGetProcAddress("eglQueryDevicesEXT");
+        if (get_platform_display)
+        {
+            EGLDeviceEXT device[8];
+            EGLint num_device = 0;
+            if (query_devices && query_devices(8, device, &num_device))
+            {
+                for (int i = 0; i < num_device; i++)
+                    candidate.push_back(get_platform_display(k_egl_platform_device, device[i], NULL));
+            }
+            candidate.push_back(get_platform_display(k_egl_platform_surfaceless, EGL_DEFAULT_DISPLAY, NULL));
+        }
+        candidate.push_back(eglGetDisplay(EGL_DEFAULT_DISPLAY));
+
+        const EGLint config_attrib[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_NONE};
+        for (EGLDisplay d : candidate)
+        {
+            EGLint major, minor, num_config = 0;
+            if (d == EGL_NO_DISPLAY || !eglInitialize(d, &major, &minor)) continue;
+            if (eglChooseConfig(d, config_attrib, &config, 1, &num_config) && num_config > 0)
+            {
+                display_ = d;
+                return true;
+            }
+            eglTerminate(d);
+        }
+        return false;
+    }
+};
+
+#endif // OFFSCREEN_CONTEXT_HPP_
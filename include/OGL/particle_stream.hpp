@@ -0,0 +1,148 @@
+#ifndef PARTICLE_STREAM_HPP_
+#define PARTICLE_STREAM_HPP_
+
+#include <iostream>
+#include <algorithm>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "common.hpp"
+
+// Per-instance particle position stream.
+// With GL 4.4 the buffer is a persistently mapped ring of k_num_stream_slot regions,
+// each guarded by a fence, so the producer writes straight into GPU-visible memory
+// while the previous frames are still being drawn. Older contexts fall back to an
+// invalidating glMapBufferRange on a single region.
+//
+// A persistent ring can also be filled by a producer on another thread that owns a
+// slot outright (get_slot()), e.g. the writer of a TripleBuffer whose three buffers
+// are backed by the three slots. The render thread then selects the slot to draw with
+// use_slot() and must wait_slot() before handing a drawn slot back to the producer.
+const unsigned int k_num_stream_slot = 3;
+
+class ParticleStreamBuffer
+{
+private:
+    GLuint buffer_;
+    GLuint location_;
+    unsigned int num_element_;
+    bool persistent_;
+
+    glm::vec3 *mapped_;
+    GLsync fence_[k_num_stream_slot];
+    unsigned int slot_;
+
+public:
+    ParticleStreamBuffer()
+    : buffer_(0)
+    , location_(0)
+    , num_element_(0)
+    , persistent_(false)
+    , mapped_(NULL)
+    , fence_{}
+    , slot_(0)
+    {
+    };
+
+    // Must be called with the target VAO bound; sets up the attribute at `location`.
+    void initialize(GLuint location, unsigned int num_element)
+    {
+        location_ = location;
+        num_element_ = num_element;
+        persistent_ = GLAD_GL_VERSION_4_4;
+
+        glGenBuffers(1, &buffer_);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+        if (persistent_)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            GLsizeiptr size = k_num_stream_slot * slot_size();
+            glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+            mapped_ = (glm::vec3 *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+        }
+        else
+        {
+            std::cout << "GL 4.4 unavailable, streaming particles without persistent mapping" << std::endl;
+            glBufferData(GL_ARRAY_BUFFER, slot_size(), NULL, GL_STREAM_DRAW);
+        }
+        glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
+
+    bool is_persistent() const { return persistent_; }
+
+    glm::vec3 *get_slot(unsigned int slot) { return mapped_ + slot * num_element_; }
+
+    void use_slot(unsigned int slot) { slot_ = slot; }
+
+    // Blocks until the GPU is done with the draws issued from slot.
+    void wait_slot(unsigned int slot)
+    {
+        if (!fence_[slot]) return;
+        while (glClientWaitSync(fence_[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(fence_[slot]);
+        fence_[slot] = 0;
+    }
+
+    // Returns a region of num_element positions the caller may fill before the next draw().
+    glm::vec3 *begin_write()
+    {
+        if (persistent_)
+        {
+            slot_ = (slot_ + 1) % k_num_stream_slot;
+            wait_slot(slot_);
+            return mapped_ + slot_ * num_element_;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+        return (glm::vec3 *)glMapBufferRange(GL_ARRAY_BUFFER, 0, slot_size(),
+                                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    }
+
+    void end_write()
+    {
+        if (persistent_) return;
+        glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+
+    // Draws `vertex_count` vertices for the first num_instance particles of the most
+    // recently written slot. Must be called with the target VAO bound.
+    void draw(GLenum mode, GLsizei vertex_count, unsigned int num_instance)
+    {
+        if (persistent_)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+            glVertexAttribPointer(location_, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)(slot_ * slot_size()));
+        }
+        glDrawArraysInstanced(mode, 0, vertex_count, std::min(num_instance, num_element_));
+        if (persistent_)
+        {
+            if (fence_[slot_]) glDeleteSync(fence_[slot_]);     // drawn again this frame; the new fence covers both
+            fence_[slot_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+    }
+
+    void release()
+    {
+        for (unsigned int i = 0; i < k_num_stream_slot; i++)
+        {
+            wait_slot(i);
+        }
+        if (mapped_)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            mapped_ = NULL;
+        }
+        glDeleteBuffers(1, &buffer_);
+    }
+
+    ~ParticleStreamBuffer() {};
+
+private:
+    inline GLsizeiptr slot_size() const { return num_element_ * sizeof(glm::vec3); }
+};
+
+#endif // PARTICLE_STREAM_HPP_
@@ -4,13 +4,14 @@
 const char* vertexShaderSource = "#version 330 core\n"
     "layout (location = 0) in vec3 aPos;\n"
     "layout (location = 1) in vec3 aColor;\n"
+    "layout (location = 2) in vec3 aOffset;\n"   // per-instance particle position, (0,0,0) for the box
     "uniform mat4 model;\n"
     "uniform mat4 view;\n"
     "uniform mat4 projection;\n"
     "out vec3 ourColor;\n"
     "void main()\n"
     "{\n"
-    "   gl_Position = projection * view * model * vec4(aPos, 1.0);\n"
+    "   gl_Position = projection * view * model * vec4(aPos + aOffset, 1.0);\n"
     "   ourColor = aColor;\n"
     "}\0";
 
@@ -23,6 +24,157 @@ const char* fragmentShaderSource = "#version 330 core\n"
     "   FragColor = vec4(ourColor, 0.3f);\n"
     "}\n\0";
 
+// Screen-space fluid (Green 2010, "Screen Space Fluid Rendering for Games"): particles are
+// drawn as sphere sprites into an eye-space depth map (with the color of the nearest
+// particle) and, additively, into a thickness map; the depth map is smoothed with a
+// separable bilateral filter and shaded full screen.
+
+// Point sprite per particle; gl_PointSize is the projected diameter. aScale enlarges the
+// sprites that stand in for several particles (ParticleCuller).
+const char* spriteVertexShaderSource = "#version 330 core\n"
+    "layout (location = 1) in vec3 aColor;\n"
+    "layout (location = 2) in vec3 aOffset;\n"
+    "layout (location = 3) in float aScale;\n"
+    "uniform mat4 view;\n"
+    "uniform mat4 projection;\n"
+    "uniform float pointScale;\n"       // framebuffer height * projection[1][1]
+    "uniform float radius;\n"
+    "out vec3 eyeCenter;\n"
+    "out vec3 ourColor;\n"
+    "out float sphereRadius;\n"
+    "void main()\n"
+    "{\n"
+    "   vec4 eye = view * vec4(aOffset, 1.0);\n"
+    "   eyeCenter = eye.xyz;\n"
+    "   sphereRadius = radius * aScale;\n"
+    "   gl_Position = projection * eye;\n"
+    "   gl_PointSize = pointScale * sphereRadius / -eye.z;\n"
+    "   ourColor = aColor;\n"
+    "}\0";
+
+// Front surface of the sphere: eye-space z (negative) and the particle color, with the
+// matching window depth so the nearest sphere wins.
+const char* spriteDepthFragmentShaderSource = "#version 330 core\n"
+    "layout (location = 0) out float fluidDepth;\n"
+    "layout (location = 1) out vec4 fluidColor;\n"
+    "in vec3 eyeCenter;\n"
+    "in vec3 ourColor;\n"
+    "in float sphereRadius;\n"
+    "uniform mat4 projection;\n"
+    "void main()\n"
+    "{\n"
+    "   vec2 p = gl_PointCoord * 2.0 - 1.0;\n"
+    "   p.y = -p.y;\n"
+    "   float r2 = dot(p, p);\n"
+    "   if (r2 > 1.0) discard;\n"
+    "   vec3 eye = eyeCenter + sphereRadius * vec3(p, sqrt(1.0 - r2));\n"
+    "   vec4 clip = projection * vec4(eye, 1.0);\n"
+    "   gl_FragDepth = 0.5 * clip.z / clip.w + 0.5;\n"
+    "   fluidDepth = eye.z;\n"
+    "   fluidColor = vec4(ourColor, 1.0);\n"
+    "}\n\0";
+
+// Chord length through the sphere, blended additively. With the sprite radius at the
+// rest spacing every point is inside ~4 pi / 3 spheres, so the chord is scaled by
+// 3 / (4 pi) to keep the sum close to the fluid thickness.
+const char* spriteThicknessFragmentShaderSource = "#version 330 core\n"
+    "out float thickness;\n"
+    "in float sphereRadius;\n"
+    "void main()\n"
+    "{\n"
+    "   vec2 p = gl_PointCoord * 2.0 - 1.0;\n"
+    "   float r2 = dot(p, p);\n"
+    "   if (r2 > 1.0) discard;\n"
+    "   thickness = 0.477 * sphereRadius * sqrt(1.0 - r2);\n"
+    "}\n\0";
+
+// Full-screen triangle, no vertex buffer.
+const char* screenVertexShaderSource = "#version 330 core\n"
+    "out vec2 uv;\n"
+    "void main()\n"
+    "{\n"
+    "   vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+    "   uv = p;\n"
+    "   gl_Position = vec4(2.0 * p - 1.0, 0.0, 1.0);\n"
+    "}\0";
+
+// One direction of the bilateral filter over the depth map. The spatial width follows the
+// projected particle size; samples further than about a particle radius in depth, and the
+// background (depth 0), do not contribute, so silhouettes stay sharp.
+const char* bilateralFragmentShaderSource = "#version 330 core\n"
+    "layout (location = 0) out float fluidDepth;\n"
+    "in vec2 uv;\n"
+    "uniform sampler2D depthMap;\n"
+    "uniform vec2 direction;\n"         // one texel along x or y
+    "uniform float pointScale;\n"
+    "uniform float radius;\n"
+    "void main()\n"
+    "{\n"
+    "   float d = texture(depthMap, uv).r;\n"
+    "   if (d >= 0.0) { fluidDepth = d; return; }\n"
+    "   float width = clamp(0.5 * pointScale * radius / -d, 1.0, 16.0);\n"
+    "   int n = int(width);\n"
+    "   float sum = 0.0;\n"
+    "   float weight = 0.0;\n"
+    "   for (int i = -n; i <= n; i++)\n"
+    "   {\n"
+    "       float s = texture(depthMap, uv + float(i) * direction).r;\n"
+    "       if (s >= 0.0) continue;\n"
+    "       float r = float(i) / (0.5 * width);\n"
+    "       float z = (s - d) / (2.0 * radius);\n"
+    "       float w = exp(-r * r - z * z);\n"
+    "       sum += s * w;\n"
+    "       weight += w;\n"
+    "   }\n"
+    "   fluidDepth = sum / weight;\n"
+    "}\n\0";
+
+// Normals from the smoothed depth (the one-sided difference with the smaller depth step),
+// Blinn-Phong with Fresnel, and Beer-Lambert absorption by thickness tinting towards the
+// color of the nearest material.
+const char* compositeFragmentShaderSource = "#version 330 core\n"
+    "out vec4 FragColor;\n"
+    "in vec2 uv;\n"
+    "uniform sampler2D depthMap;\n"
+    "uniform sampler2D thicknessMap;\n"
+    "uniform sampler2D colorMap;\n"
+    "uniform mat4 projection;\n"
+    "uniform vec2 texel;\n"
+    "uniform vec3 lightDir;\n"          // eye space, towards the light
+    "uniform float absorption;\n"
+    "vec3 eyePosition(vec2 t)\n"
+    "{\n"
+    "   float z = texture(depthMap, t).r;\n"
+    "   vec2 ndc = 2.0 * t - 1.0;\n"
+    "   return vec3(-ndc.x * z / projection[0][0], -ndc.y * z / projection[1][1], z);\n"
+    "}\n"
+    "vec3 derivative(vec3 p, vec2 delta)\n"
+    "{\n"
+    "   vec3 forward = eyePosition(uv + delta) - p;\n"
+    "   vec3 backward = p - eyePosition(uv - delta);\n"
+    "   if (texture(depthMap, uv + delta).r >= 0.0) return backward;\n"
+    "   if (texture(depthMap, uv - delta).r >= 0.0) return forward;\n"
+    "   return abs(forward.z) < abs(backward.z) ? forward : backward;\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "   float z = texture(depthMap, uv).r;\n"
+    "   if (z >= 0.0) discard;\n"
+    "   vec3 p = eyePosition(uv);\n"
+    "   vec3 n = normalize(cross(derivative(p, vec2(texel.x, 0.0)), derivative(p, vec2(0.0, texel.y))));\n"
+    "   vec3 v = normalize(-p);\n"
+    "   float thickness = texture(thicknessMap, uv).r;\n"
+    "   vec3 base = texture(colorMap, uv).rgb;\n"
+    "   vec3 transmitted = exp(-absorption * thickness * (1.0 - base));\n"
+    "   float diffuse = 0.5 + 0.5 * max(dot(n, lightDir), 0.0);\n"
+    "   float specular = pow(max(dot(n, normalize(lightDir + v)), 0.0), 60.0);\n"
+    "   float fresnel = 0.05 + 0.95 * pow(1.0 - max(dot(n, v), 0.0), 5.0);\n"
+    "   vec3 color = mix(transmitted * diffuse, vec3(0.8, 0.9, 1.0), 0.5 * fresnel) + vec3(specular);\n"
+    "   vec4 clip = projection * vec4(p, 1.0);\n"
+    "   gl_FragDepth = 0.5 * clip.z / clip.w + 0.5;\n"
+    "   FragColor = vec4(color, max(1.0 - exp(-absorption * thickness), fresnel));\n"
+    "}\n\0";
+
 // const char* fragmentShaderSource = "#version 330 core\n"
 //     "out vec4 FragColor;\n"
 //     "in vec3 ourColor;\n"
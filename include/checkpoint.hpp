@@ -0,0 +1,263 @@
+#ifndef CHECKPOINT_HPP_
+#define CHECKPOINT_HPP_
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.hpp"
+#include "particle.hpp"
+#include "rigid_body.hpp"
+#include "timer.hpp"
+
+// Binary snapshot of the full solver state.
+//
+// Layout (little-endian, no padding between sections):
+//   header                                       (checkpoint::header)
+//   every Particle array in Particle::for_each_array() order, k_num_particle_capacity elements each
+//   header.num_body RigidBodySystem::body states
+//
+// A checkpoint only restores into a scene with the same pool capacity, initial
+// particle count (the particle mass), world size, time step, neighbour count,
+// materials, integrator, stiffness, emitters, sinks, rigid bodies and force field
+// file; everything else is rejected. The pool is saved compact, so the
+// active particles are the first header.num_active slots.
+namespace checkpoint
+{
+
+const char k_magic[4] = {'S', 'P', 'H', 'C'};
+const uint32_t k_version = 7;     // 2: counter-based RNG state replaces the table, 3: particle pool, 4: material ids, 5: rigid bodies,
+                                  // 6: materials, integrator and stiffness, 7: particle count, neighbours and scene hash
+
+struct header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t num_particle;      // pool capacity
+    int32_t world_edge_size;
+    float time_step;
+    float simulation_time;
+    uint64_t step;
+    uint64_t rand_seed;
+    uint64_t rand_counter;
+    uint32_t num_active;
+    uint32_t num_body;
+    uint64_t solver_step;
+    uint32_t fluid_material;
+    uint32_t secondary_material;
+    uint32_t integrator;
+    float fluid_stiffness;
+    uint32_t num_particle_each_side;
+    uint32_t num_neighboring_particle;
+    uint64_t scene_hash;        // scene_hash() of the emitters, sinks, rigid bodies and force field
+};
+
+// FNV-1a over the scene settings the header has no field for. Rigid body centres are
+// left out: the saved body states replace them.
+inline uint64_t scene_hash()
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&](const void *data, size_t bytes) {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < bytes; i++) hash = (hash ^ p[i]) * 1099511628211ull;
+    };
+    auto add_string = [&](const std::string &s) {
+        uint64_t size = s.size();
+        add(&size, sizeof(size));
+        add(s.data(), s.size());
+    };
+
+    uint64_t count = k_emitters.size();
+    add(&count, sizeof(count));
+    for (const EmitterConfig &e : k_emitters)
+    {
+        add(e.center, sizeof(e.center));
+        add(e.direction, sizeof(e.direction));
+        add(&e.radius, sizeof(e.radius));
+        add(&e.speed, sizeof(e.speed));
+        add(&e.rate, sizeof(e.rate));
+        add_string(e.material);
+    }
+    count = k_sinks.size();
+    add(&count, sizeof(count));
+    for (const SinkConfig &s : k_sinks)
+    {
+        add(s.lo, sizeof(s.lo));
+        add(s.hi, sizeof(s.hi));
+    }
+    count = k_rigid_bodies.size();
+    add(&count, sizeof(count));
+    for (const RigidBodyConfig &b : k_rigid_bodies)
+    {
+        unsigned char ellipsoid = b.ellipsoid;
+        add(&ellipsoid, sizeof(ellipsoid));
+        add(b.extent, sizeof(b.extent));
+        add(&b.density, sizeof(b.density));
+    }
+    add_string(k_force_field_path);
+    return hash;
+}
+
+inline bool write_all(int fd, const void *data, size_t bytes)
+{
+    const char *p = static_cast<const char *>(data);
+    while (bytes > 0)
+    {
+        ssize_t n = ::write(fd, p, bytes);
+        if (n <= 0) return false;
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+bool save(const std::string &path, Particle &particles, RigidBodySystem &bodies, Timer &timer, uint64_t step)
+{
+    if (!is_little_endian())
+    {
+        std::cout << "Checkpoints are only supported on little-endian hosts" << std::endl;
+        return false;
+    }
+
+    RandGenerator &rng = particles.get_rand_generator();
+    header h;
+    std::memcpy(h.magic, k_magic, sizeof(k_magic));
+    h.version = k_version;
+    particles.compact();
+    h.num_particle = k_num_particle_capacity;
+    h.world_edge_size = k_world_edge_size;
+    h.time_step = k_time_step;
+    h.simulation_time = timer.get_simluation_time();
+    h.step = step;
+    h.rand_seed = rng.get_seed();
+    h.rand_counter = rng.get_counter();
+    h.num_active = particles.get_num_active();
+    h.num_body = bodies.get_bodies().size();
+    h.solver_step = particles.solver_step;
+    h.fluid_material = k_fluid_material;
+    h.secondary_material = k_secondary_material;
+    h.integrator = k_integration_method;
+    h.fluid_stiffness = k_fluid_stiffness;
+    h.num_particle_each_side = k_num_particle_each_side;
+    h.num_neighboring_particle = k_num_neighboring_particle;
+    h.scene_hash = scene_hash();
+
+    // write to a temporary file and rename, so a crash never leaves a truncated checkpoint
+    std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cout << "Failed to open checkpoint file: " << tmp_path << std::endl;
+        return false;
+    }
+
+    bool ok = write_all(fd, &h, sizeof(h));
+    particles.for_each_array([&](void *data, size_t bytes) { ok = ok && write_all(fd, data, bytes); });
+    bodies.for_each_state([&](void *data, size_t bytes) { ok = ok && write_all(fd, data, bytes); });
+    ok = (::close(fd) == 0) && ok;
+
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        std::cout << "Failed to write checkpoint: " << path << std::endl;
+        ::unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// On success the particles, rigid bodies and RNG are overwritten, the timer resumes at the saved
+// simulation time and step receives the saved step count.
+bool load(const std::string &path, Particle &particles, RigidBodySystem &bodies, Timer &timer, uint64_t &step)
+{
+    if (!is_little_endian())
+    {
+        std::cout << "Checkpoints are only supported on little-endian hosts" << std::endl;
+        return false;
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << "Failed to open checkpoint file: " << path << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header))
+    {
+        std::cout << "Invalid checkpoint file: " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    size_t file_size = st.st_size;
+    void *map = ::mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        std::cout << "Failed to map checkpoint file: " << path << std::endl;
+        return false;
+    }
+    ::madvise(map, file_size, MADV_SEQUENTIAL);
+
+    const char *p = static_cast<const char *>(map);
+    header h;
+    std::memcpy(&h, p, sizeof(h));
+
+    size_t expected = sizeof(h);
+    particles.for_each_array([&](void *, size_t bytes) { expected += bytes; });
+    bodies.for_each_state([&](void *, size_t bytes) { expected += bytes; });
+
+    RandGenerator &rng = particles.get_rand_generator();
+    bool ok = true;
+    if (std::memcmp(h.magic, k_magic, sizeof(k_magic)) != 0 || h.version != k_version)
+    {
+        std::cout << "Not a version " << k_version << " checkpoint: " << path << std::endl;
+        ok = false;
+    }
+    else if (h.num_particle != k_num_particle_capacity || h.num_active > h.num_particle || h.world_edge_size != k_world_edge_size || h.time_step != k_time_step
+          || h.num_body != bodies.get_bodies().size() || h.fluid_material != (uint32_t)k_fluid_material || h.secondary_material != (uint32_t)k_secondary_material
+          || h.integrator != (uint32_t)k_integration_method || h.fluid_stiffness != k_fluid_stiffness
+          || h.num_particle_each_side != k_num_particle_each_side || h.num_neighboring_particle != k_num_neighboring_particle
+          || h.scene_hash != scene_hash())
+    {
+        std::cout << "Checkpoint scene does not match the current configuration: " << path << std::endl;
+        ok = false;
+    }
+    else if (file_size != expected)
+    {
+        std::cout << "Truncated or corrupt checkpoint: " << path << std::endl;
+        ok = false;
+    }
+
+    if (ok)
+    {
+        p += sizeof(h);
+        rng.restore(h.rand_seed, h.rand_counter);
+
+        auto restore = [&](void *data, size_t bytes) {
+            std::memcpy(data, p, bytes);
+            p += bytes;
+        };
+        particles.for_each_array(restore);
+        bodies.for_each_state(restore);
+        particles.set_num_active(h.num_active);
+        particles.solver_step = h.solver_step;
+
+        timer.restore(h.simulation_time);
+        step = h.step;
+    }
+
+    ::munmap(map, file_size);
+    return ok;
+}
+
+} // namespace checkpoint
+
+#endif // CHECKPOINT_HPP_
@@ -29,19 +29,20 @@ struct result
 
 const static result null_result = {{-1, -1, -1}, {-1, -1, -1}};
 
+// points are in units of k_world_edge_size
 plain box_plain[6] = 
 {
-    {{1, 0, 0}, {0, 0, 0}},                                                     // BACK
-    {{0, 1, 0}, {0, 0, 0}},                                                     // LEFT
-    {{0, 0, 1}, {0, 0, 0}},                                                     // BOTTOM
-    {{-1, 0, 0}, {k_world_edge_size, k_world_edge_size, k_world_edge_size}},    // FRONT
-    {{0, -1, 0}, {k_world_edge_size, k_world_edge_size, k_world_edge_size}},    // RIGHT
-    {{0, 0, -1}, {k_world_edge_size, k_world_edge_size, k_world_edge_size}},    // TOP
+    {{1, 0, 0}, {0, 0, 0}},     // BACK
+    {{0, 1, 0}, {0, 0, 0}},     // LEFT
+    {{0, 0, 1}, {0, 0, 0}},     // BOTTOM
+    {{-1, 0, 0}, {1, 1, 1}},    // FRONT
+    {{0, -1, 0}, {1, 1, 1}},    // RIGHT
+    {{0, 0, -1}, {1, 1, 1}},    // TOP
 };
 
 inline float calculate_signed_distance(int i, glm::vec3 &pos) 
 {
-    glm::vec3 v = pos - box_plain[i].point;
+    glm::vec3 v = pos - box_plain[i].point * (float)k_world_edge_size;
     return glm::dot(box_plain[i].normal, v);
 }
 
@@ -6,22 +6,64 @@
 #include <cmath>
 #include <string>
 #include <map>
+#include <algorithm>
+#include <cstdint>
 
 #include <glm/glm.hpp>
 
+#include "simulation_config.hpp"
+#include "force_field_keyframe.hpp"
+
 const char k_project_name[] = "FLUID SIMULATION";
 
+// Scene parameters below without `const` are set once at startup by
+// apply_simulation_config() and must not change while a Solver exists.
+
 // World Params --------------------------------------------------------------------------//
-const int k_world_edge_size = 32;
+int k_world_edge_size = 32;
 const glm::vec3 k_gravity_acceleration = {0.0f, 0.0f, -9.8f};
-const unsigned int k_num_particle_each_side = 70;
-const unsigned int k_num_particle = std::pow(k_num_particle_each_side, 2);
+unsigned int k_num_particle_each_side = 70;
+unsigned int k_num_particle = std::pow(k_num_particle_each_side, 2);     // initial count, sets the particle mass
+unsigned int k_pool_capacity = 0;
+unsigned int k_num_particle_capacity = k_num_particle;                  // slots per particle array, >= k_num_particle
+
+// Inflow / outflow ----------------------------------------------------------------//
+std::vector<EmitterConfig> k_emitters;
+std::vector<SinkConfig> k_sinks;
+std::vector<RigidBodyConfig> k_rigid_bodies;
+
+// External force field ------------------------------------------------------------//
+std::string k_force_field_path;           // keyframed grid file (force_field_grid.hpp); empty: the electric field
 
 // Timer --------------------------------------------------------------------//
-const float k_time_step = 0.01;                 // sec
-const unsigned int k_max_display_time = 60;     // sec
+float k_time_step = 0.01;                 // sec
+unsigned int k_max_display_time = 60;     // sec
+
+// Scene --------------------------------------------------------------------//
+enum scene_preset
+{
+    random_box, dam_break, drop, tank, empty
+};
+scene_preset k_scene_preset = scene_preset::random_box;
+
+enum sampling
+{
+    lattice, poisson_disk
+};
+sampling k_sampling = sampling::lattice;  // placement inside the fluid regions of a preset
+unsigned int k_seed = 0;                  // 0: a different random seed every run
+
+// Integrator --------------------------------------------------------------------//
+enum integrator 
+{
+    ex_euler, im_euler, rk2, verlet
+};
+integrator k_integration_method  = integrator::verlet;
 
 // Material -----------------------------------------------------------------//
+const glm::vec3 k_particle_color = {153/255, 255/255, 255/255};
+const glm::vec3 k_secondary_particle_color = {1.0f, 0.6f, 0.2f};     // every material but k_fluid_material
+
 enum material
 {
     water, mercury, air
@@ -42,29 +84,228 @@ std::map<material, property> material_property_map =
     { material::air, {1.18, 18.7, 15.8, 0} }
 };
 
-material k_fluid_material = material::mercury;
+const unsigned int k_num_material = material::air + 1;
+
+const std::map<std::string, material> k_material_names = 
+{
+    { "water", material::water },
+    { "mercury", material::mercury },
+    { "air", material::air }
+};
+
+material k_fluid_material = material::mercury;          // fills the scene and is the default for emitters
 property k_fluid_property = material_property_map[k_fluid_material];
-const float k_fluid_stiffness = 1.0f;
+material k_secondary_material = material::mercury;      // second fluid of the scene presets, k_fluid_material if none
+bool k_multi_material = false;
+float k_fluid_stiffness = 1.0f;
+const float k_pressure_force_scale = 0.0002f;
 
-const float k_surface_tension_level_threshold = 0.0f;
+// Per-material constants as a structure of arrays indexed by material id, so the
+// solver loops look up the properties of particle i and neighbour j without
+// branching on the material.
+struct material_table
+{
+    float rest_density[k_num_material];
+    float dynamic[k_num_material];
+    float surface_tension[k_num_material];
+    float particle_mass[k_num_material];    // every particle has the same volume
+    glm::vec3 color[k_num_material];
+};
+material_table k_material_table;
+
+// steps between reorders of the particles by (grid cell, material), multi-material only
+const unsigned int k_material_sort_interval = 25;
 
-const float k_fluid_volume = std::pow(k_world_edge_size, 3) / 2;  // fill half of the box
-const float k_particle_mass = k_fluid_property.density * k_fluid_volume / k_num_particle;
-const float k_particle_radius = std::pow((((3 * k_particle_mass) / (4 * M_PI * k_fluid_property.density))), 1/3);
+// a particle is on the free surface if its scaled color-field gradient s * |sum_j V_j grad W_ij|
+// exceeds this; deep inside the fluid the gradient cancels to ~0
+const float k_surface_tension_level_threshold = 0.3f;
+
+float k_fluid_volume;      // fill half of the box
+float k_particle_mass;
+float k_particle_radius;
 
 // SPH System ----------------------------------------------------------------------//
-const unsigned int k_num_neighboring_particle = 100;
-const float k_sph_s = std::pow((3 * k_fluid_volume * k_num_neighboring_particle) / (4 * M_PI * k_num_particle), 1/3);
+unsigned int k_num_neighboring_particle = 100;
+float k_sph_s;
+
+// kernel normalization factors, derived from k_sph_s
+float k_sph_s2;
+float k_sph_poly6_coef;         //  315 / (64 pi s^9)
+float k_sph_poly6_grad_coef;    // -945 / (32 pi s^9)
+float k_sph_spiky_coef;         //   45 / (pi s^6)
+float k_sph_cohesion_coef;      //   32 / (pi s^9)
+
+static std::vector<std::vector<unsigned int>> neighborhood;
+
+inline void update_derived_constants()
+{
+    k_num_particle = std::pow(k_num_particle_each_side, 2);
+    k_num_particle_capacity = std::max(k_num_particle, k_pool_capacity);
+    k_fluid_property = material_property_map[k_fluid_material];
+
+    k_fluid_volume = std::pow(k_world_edge_size, 3) / 2;
+    k_particle_mass = k_fluid_property.density * k_fluid_volume / k_num_particle;
+    k_particle_radius = std::pow((((3 * k_particle_mass) / (4 * M_PI * k_fluid_property.density))), 1.0f / 3);
+    for (unsigned int m = 0; m < k_num_material; m++)
+    {
+        const property &p = material_property_map[(material)m];
+        k_material_table.rest_density[m] = p.density;
+        k_material_table.dynamic[m] = p.dynamic;
+        k_material_table.surface_tension[m] = p.surface_tension;
+        k_material_table.particle_mass[m] = p.density * k_fluid_volume / k_num_particle;
+        k_material_table.color[m] = (material)m == k_fluid_material ? k_particle_color : k_secondary_particle_color;
+    }
+    k_sph_s = std::pow((3 * k_fluid_volume * k_num_neighboring_particle) / (4 * M_PI * k_num_particle), 1.0f / 3);
+
+    k_sph_s2 = std::pow(k_sph_s, 2);
+    k_sph_poly6_coef = 315 / (64 * M_PI * std::pow(k_sph_s, 9));
+    k_sph_poly6_grad_coef = -945 / (32 * M_PI * std::pow(k_sph_s, 9));
+    k_sph_spiky_coef = 45 / (M_PI * std::pow(k_sph_s, 6));
+    k_sph_cohesion_coef = 32 / (M_PI * std::pow(k_sph_s, 9));
+
+    neighborhood.assign(k_num_particle_capacity, std::vector<unsigned int>(0));
+}
+
+// Returns false (leaving the current scene untouched) on an unknown name, a
+// non-positive particle count, box size, time step, neighbour count or stiffness,
+// an emitter with a zero direction or a negative radius, speed or rate, or a
+// rigid body with a non-positive extent or density.
+inline bool apply_simulation_config(const SimulationConfig &config)
+{
+    std::vector<std::string> used_materials = {config.material};
+    if (!config.secondary_material.empty()) used_materials.push_back(config.secondary_material);
+    for (const EmitterConfig &e : config.emitters)
+    {
+        if (!e.material.empty()) used_materials.push_back(e.material);
+    }
+    for (const std::string &name : used_materials)
+    {
+        if (k_material_names.find(name) == k_material_names.end())
+        {
+            std::cout << "Unknown material: " << name << std::endl;
+            return false;
+        }
+    }
+    for (const EmitterConfig &e : config.emitters)
+    {
+        const float d2 = e.direction[0] * e.direction[0] + e.direction[1] * e.direction[1] + e.direction[2] * e.direction[2];
+        if (!(d2 > 0.0f) || !(e.radius >= 0.0f) || !(e.speed >= 0.0f) || !(e.rate >= 0.0f))
+        {
+            std::cout << "Invalid emitter: direction must be non-zero, radius, speed and rate non-negative" << std::endl;
+            return false;
+        }
+    }
+    std::map<std::string, integrator> integrator_names = 
+    {
+        { "ex_euler", integrator::ex_euler },
+        { "verlet", integrator::verlet }
+    };
+    if (integrator_names.find(config.integrator) == integrator_names.end())
+    {
+        std::cout << "Unknown integrator: " << config.integrator << std::endl;
+        return false;
+    }
 
+    std::map<std::string, scene_preset> scene_names = 
+    {
+        { "random", scene_preset::random_box },
+        { "dam_break", scene_preset::dam_break },
+        { "drop", scene_preset::drop },
+        { "tank", scene_preset::tank },
+        { "empty", scene_preset::empty }
+    };
+    if (scene_names.find(config.scene) == scene_names.end())
+    {
+        std::cout << "Unknown scene: " << config.scene << std::endl;
+        return false;
+    }
 
-static std::vector<std::vector<unsigned int>> neighborhood(k_num_particle, std::vector<unsigned int>(0));
+    std::map<std::string, sampling> sampling_names = 
+    {
+        { "lattice", sampling::lattice },
+        { "poisson", sampling::poisson_disk }
+    };
+    if (sampling_names.find(config.sampling) == sampling_names.end())
+    {
+        std::cout << "Unknown sampling: " << config.sampling << std::endl;
+        return false;
+    }
+
+    if (config.num_particle_each_side == 0)
+    {
+        std::cout << "num_particle_each_side must be positive" << std::endl;
+        return false;
+    }
+    if (config.world_edge_size <= 0)
+    {
+        std::cout << "world_edge_size must be positive: " << config.world_edge_size << std::endl;
+        return false;
+    }
+    if (!(config.time_step > 0.0f))
+    {
+        std::cout << "time_step must be positive: " << config.time_step << std::endl;
+        return false;
+    }
+    if (config.num_neighboring_particle == 0)
+    {
+        std::cout << "num_neighboring_particle must be positive" << std::endl;
+        return false;
+    }
+    if (!(config.fluid_stiffness > 0.0f))
+    {
+        std::cout << "fluid_stiffness must be positive: " << config.fluid_stiffness << std::endl;
+        return false;
+    }
+    for (const RigidBodyConfig &b : config.rigid_bodies)
+    {
+        if (!(b.extent[0] > 0.0f && b.extent[1] > 0.0f && b.extent[2] > 0.0f && b.density > 0.0f))
+        {
+            std::cout << "Invalid rigid body: extent and density must be positive" << std::endl;
+            return false;
+        }
+    }
+
+    ForceFieldKeyframeHeader force_field_header;
+    if (!config.force_field.empty() && !read_force_field_keyframe_header(config.force_field, force_field_header))
+    {
+        return false;
+    }
+
+    k_num_particle_each_side = config.num_particle_each_side;
+    k_world_edge_size = config.world_edge_size;
+    k_fluid_material = k_material_names.at(config.material);
+    k_secondary_material = config.secondary_material.empty() ? k_fluid_material : k_material_names.at(config.secondary_material);
+    k_multi_material = false;
+    for (const std::string &name : used_materials)
+    {
+        k_multi_material = k_multi_material || k_material_names.at(name) != k_fluid_material;
+    }
+    k_integration_method = integrator_names[config.integrator];
+    k_fluid_stiffness = config.fluid_stiffness;
+    k_time_step = config.time_step;
+    k_max_display_time = config.max_display_time;
+    k_num_neighboring_particle = config.num_neighboring_particle;
+    k_scene_preset = scene_names[config.scene];
+    k_sampling = sampling_names[config.sampling];
+    k_seed = config.seed;
+    k_pool_capacity = config.pool_capacity;
+    k_emitters = config.emitters;
+    k_sinks = config.sinks;
+    k_rigid_bodies = config.rigid_bodies;
+    k_force_field_path = config.force_field;
+    update_derived_constants();
+    return true;
+}
+
+// defaults above are usable without calling apply_simulation_config()
+static const bool k_derived_constants_initialized = (update_derived_constants(), true);
 
 inline float sph_default_kernel(glm::vec3 r)
 {
     float r_len = glm::length(r);
     if (r_len <= k_sph_s)
     {
-        return (315 / (64 * M_PI * std::pow(k_sph_s, 9))) * (std::pow((std::pow(k_sph_s, 2) - std::pow(r_len, 2)), 3));
+        return k_sph_poly6_coef * (std::pow((k_sph_s2 - std::pow(r_len, 2)), 3));
     }
     else 
     {
@@ -96,38 +337,63 @@ inline float sph_default_kernel(glm::vec3 r)
 
 inline glm::vec3 sph_default_kernel_gradient(glm::vec3 r)
 {
-    return r
-        * (float)((-945 / (32 * M_PI * std::pow(k_sph_s, 9))) * std::pow((std::pow(k_sph_s, 2) - std::pow(glm::length(r), 2)), 2));
+    float q = k_sph_s2 - glm::dot(r, r);
+    return r * (k_sph_poly6_grad_coef * q * q);
 }
 
 inline float sph_default_kernel_laplacian(glm::vec3 r)
 {
     float r_len = glm::length(r);
-    return (-945 / (32 * M_PI * std::pow(k_sph_s, 9))) * (std::pow(k_sph_s, 2) - std::pow(r_len, 2)) * (3 * std::pow(k_sph_s, 2) - 7 * std::pow(r_len, 2));
+    return k_sph_poly6_grad_coef * (k_sph_s2 - std::pow(r_len, 2)) * (3 * k_sph_s2 - 7 * std::pow(r_len, 2));
 }
 
 inline glm::vec3 sph_pressure_kernel_gradient(glm::vec3 r)
 {
     float r_len = glm::length(r);
-    if (0 < r_len && r_len < 1e-5) return glm::vec3(-45 / (M_PI * std::pow(k_sph_s, 6)));
-    else if (-1e-5 < r_len && r_len <= 0) return glm::vec3(45 / (M_PI * std::pow(k_sph_s, 6)));
-    else return r / r_len * (float)(-45 / (M_PI * std::pow(k_sph_s, 6)) * std::pow((k_sph_s - r_len), 2));  
+    if (0 < r_len && r_len < 1e-5) return glm::vec3(-k_sph_spiky_coef);
+    else if (-1e-5 < r_len && r_len <= 0) return glm::vec3(k_sph_spiky_coef);
+    else return r / r_len * (float)(-k_sph_spiky_coef * std::pow((k_sph_s - r_len), 2));  
 }
 
 inline float sph_diffusion_kernel_laplacian(glm::vec3 r)
 {
-    return (45 / (M_PI * std::pow(k_sph_s, 6))) * (k_sph_s - glm::length(r));
+    return k_sph_spiky_coef * (k_sph_s - glm::length(r));
 }
 
-// Integrator --------------------------------------------------------------------//
-enum integrator 
+// Cohesion spline of Akinci et al. 2013: attracting beyond s / 2, slightly repelling
+// closer in. Takes the distance |x_i - x_j|.
+inline float sph_cohesion_kernel(float r_len)
 {
-    ex_euler, im_euler, rk2, verlet
+    if (r_len > k_sph_s) return 0.0f;
+    float c = (k_sph_s - r_len) * r_len;
+    c = c * c * c;
+    if (2 * r_len > k_sph_s) return k_sph_cohesion_coef * c;
+    return k_sph_cohesion_coef * (2 * c - k_sph_s2 * k_sph_s2 * k_sph_s2 / 64);
+}
+
+// Kernel policy used by SphSolver; all functions take r = x_i - x_j.
+struct StandardKernel
+{
+    static inline float density(glm::vec3 r) { return sph_default_kernel(r); }
+    static inline glm::vec3 density_gradient(glm::vec3 r) { return sph_default_kernel_gradient(r); }
+    static inline float density_laplacian(glm::vec3 r) { return sph_default_kernel_laplacian(r); }
+    static inline glm::vec3 pressure_gradient(glm::vec3 r) { return sph_pressure_kernel_gradient(r); }
+    static inline float viscosity_laplacian(glm::vec3 r) { return sph_diffusion_kernel_laplacian(r); }
+    static inline float cohesion(float r_len) { return sph_cohesion_kernel(r_len); }
 };
-const integrator k_integration_method  = integrator::verlet;
 
 
+// Binary files -------------------------------------------------------------//
+// Checkpoints, frame records and trajectories are raw little-endian structs; they
+// are refused on other hosts.
+inline bool is_little_endian()
+{
+    const uint16_t probe = 1;
+    return *reinterpret_cast<const uint8_t *>(&probe) == 1;
+}
+
 // OpenGL -------------------------------------------------------------------//
+const glm::vec3 k_rigid_body_color = {0.55f, 0.4f, 0.3f};
 inline glm::vec3 transform_world2gl(glm::vec3 &v) { return (v * 2.0f / (float)k_world_edge_size) - 1.0f; }
 inline glm::vec3 transform_gl2world(glm::vec3 &v) { return (v + 1.0f) * (float)(k_world_edge_size / 2.0f); }
 
@@ -0,0 +1,111 @@
+#ifndef FLOW_BOUNDARY_HPP_
+#define FLOW_BOUNDARY_HPP_
+
+#include <vector>
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <omp.h>
+
+#include "common.hpp"
+#include "particle.hpp"
+
+// Inflow emitters and outflow sinks from k_emitters / k_sinks, applied once per step
+// after the integrator. Emitter e releases floor(rate * dt * (s + 1)) - floor(rate * dt * s)
+// particles at solver step s, at positions drawn from stream 4 + e of the particle RNG,
+// so emission is deterministic and resumes exactly from a checkpoint.
+class FlowBoundary
+{
+private:
+    struct nozzle
+    {
+        glm::vec3 center;
+        glm::vec3 direction;
+        glm::vec3 u, v;         // spans the disc
+        float radius;
+        float speed;
+        double rate;
+        material fluid;
+    };
+
+    std::vector<nozzle> nozzles_;
+    std::vector<uint8_t> removed_;
+    unsigned long num_dropped_;
+
+public:
+    FlowBoundary()
+    : num_dropped_(0)
+    {
+        // apply_simulation_config() rejects zero directions and negative radius / speed / rate
+        for (const EmitterConfig &e : k_emitters)
+        {
+            nozzle n;
+            n.center = {e.center[0], e.center[1], e.center[2]};
+            n.direction = glm::normalize(glm::vec3(e.direction[0], e.direction[1], e.direction[2]));
+            glm::vec3 up = std::abs(n.direction.z) < 0.9f ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+            n.u = glm::normalize(glm::cross(n.direction, up));
+            n.v = glm::cross(n.direction, n.u);
+            n.radius = e.radius;
+            n.speed = e.speed;
+            n.rate = e.rate;
+            n.fluid = e.material.empty() ? k_fluid_material : k_material_names.at(e.material);
+            nozzles_.push_back(n);
+        }
+    };
+
+    bool is_enabled() const { return !k_emitters.empty() || !k_sinks.empty(); }
+    unsigned long get_num_dropped() const { return num_dropped_; }
+
+    // Removes particles inside a sink, emits new ones and leaves the pool compact.
+    void apply(Particle &particles)
+    {
+        const int n = particles.get_num_active();
+        if (!k_sinks.empty())
+        {
+            removed_.assign(n, 0);
+            #pragma omp parallel for
+            for (int i = 0; i < n; i++)
+            {
+                for (const SinkConfig &k : k_sinks)
+                {
+                    const glm::vec3 &p = particles.position[i];
+                    if (p.x >= k.lo[0] && p.y >= k.lo[1] && p.z >= k.lo[2] && p.x <= k.hi[0] && p.y <= k.hi[1] && p.z <= k.hi[2])
+                    {
+                        removed_[i] = 1;
+                        break;
+                    }
+                }
+            }
+            for (int i = 0; i < n; i++) if (removed_[i]) particles.kill(i);
+        }
+
+        const RandGenerator &rng = particles.get_rand_generator();
+        const uint64_t s = particles.solver_step;
+        for (unsigned int e = 0; e < nozzles_.size(); e++)
+        {
+            const nozzle &z = nozzles_[e];
+            uint64_t begin = (uint64_t)std::floor(z.rate * k_time_step * s);
+            uint64_t end = (uint64_t)std::floor(z.rate * k_time_step * (s + 1));
+            for (uint64_t k = begin; k < end; k++)
+            {
+                glm::vec3 t = rng.generate_random_uniform_vec3_at(k, 0.0f, 1.0f, 4 + e);
+                float r = z.radius * std::sqrt(t.x);
+                float theta = 2.0f * (float)M_PI * t.y;
+                glm::vec3 p = z.center + r * (std::cos(theta) * z.u + std::sin(theta) * z.v)
+                            + z.direction * (z.speed * k_time_step * t.z);      // spread along the first step
+                if (particles.spawn(p, z.speed * z.direction, z.fluid) < 0)
+                {
+                    if (num_dropped_++ == 0) std::cout << "Particle pool full, emitters are dropping particles" << std::endl;
+                }
+            }
+        }
+
+        particles.compact();
+    }
+
+    ~FlowBoundary() {};
+};
+
+#endif // FLOW_BOUNDARY_HPP_
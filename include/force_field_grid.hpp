@@ -0,0 +1,281 @@
+#ifndef FORCE_FIELD_GRID_HPP_
+#define FORCE_FIELD_GRID_HPP_
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <glm/glm.hpp>
+#include <omp.h>
+
+#include "common.hpp"
+#include "force_field_keyframe.hpp"
+
+// Analytic fields (see velocity_field.hpp) sampled once onto a regular grid over
+// the [0, k_world_edge_size]^3 box and read back by trilinear interpolation.
+const unsigned int k_force_field_grid_resolution = 64;    // nodes per side
+
+class ForceFieldGrid
+{
+private:
+    unsigned int resolution_;
+    float cell_size_;
+    std::vector<glm::vec3> samples_;
+
+public:
+    ForceFieldGrid(unsigned int resolution = k_force_field_grid_resolution)
+    : resolution_(resolution)
+    , cell_size_((float)k_world_edge_size / (resolution - 1))
+    {
+    };
+
+    // field: any callable glm::vec3(glm::vec3 world_pos); samples are allocated on the first bake
+    template <typename Field>
+    void bake(Field field)
+    {
+        const int n = resolution_;
+        samples_.resize(resolution_ * resolution_ * resolution_);
+        #pragma omp parallel for collapse(2)
+        for (int z = 0; z < n; z++)
+        {
+            for (int y = 0; y < n; y++)
+            {
+                for (int x = 0; x < n; x++)
+                {
+                    samples_[index(x, y, z)] = field(glm::vec3(x, y, z) * cell_size_);
+                }
+            }
+        }
+    }
+
+    inline glm::vec3 sample(const glm::vec3 &pos) const { return sample(samples_.data(), resolution_, cell_size_, pos); }
+
+    // Trilinear lookup in any resolution^3 array with this layout, e.g. a keyframe in a mapped file.
+    static inline glm::vec3 sample(const glm::vec3 *samples, unsigned int resolution, float cell_size, const glm::vec3 &pos)
+    {
+        // clamp to the box so particles that leaked through a wall read the boundary value
+        glm::vec3 g = pos / cell_size;
+        const float g_max = (float)(resolution - 1);
+        int i0[3];
+        float t[3];
+        for (int a = 0; a < 3; a++)
+        {
+            float c = std::min(std::max(g[a], 0.0f), g_max);
+            i0[a] = std::min((int)c, (int)resolution - 2);
+            t[a] = c - i0[a];
+        }
+
+        const glm::vec3 *p = &samples[(i0[2] * resolution + i0[1]) * resolution + i0[0]];
+        const unsigned int sy = resolution;
+        const unsigned int sz = resolution * resolution;
+
+        glm::vec3 c00 = p[0]       + (p[1]            - p[0])       * t[0];
+        glm::vec3 c10 = p[sy]      + (p[sy + 1]       - p[sy])      * t[0];
+        glm::vec3 c01 = p[sz]      + (p[sz + 1]       - p[sz])      * t[0];
+        glm::vec3 c11 = p[sz + sy] + (p[sz + sy + 1]  - p[sz + sy]) * t[0];
+
+        glm::vec3 c0 = c00 + (c10 - c00) * t[1];
+        glm::vec3 c1 = c01 + (c11 - c01) * t[1];
+        return c0 + (c1 - c0) * t[2];
+    }
+
+    unsigned int get_resolution() const { return resolution_; }
+    std::vector<glm::vec3> &get_samples() { return samples_; }
+    const std::vector<glm::vec3> &get_samples() const { return samples_; }
+
+    ~ForceFieldGrid() {};
+
+private:
+    inline unsigned int index(unsigned int x, unsigned int y, unsigned int z) const
+    {
+        return (z * resolution_ + y) * resolution_ + x;
+    }
+};
+
+
+class ForceFieldKeyframeWriter
+{
+private:
+    std::ofstream file_;
+    std::string path_;
+    ForceFieldKeyframeHeader header_;
+
+public:
+    bool open(const std::string &path, unsigned int resolution, float keyframe_interval)
+    {
+        if (!is_little_endian())
+        {
+            std::cout << "Force field keyframes are only supported on little-endian hosts" << std::endl;
+            return false;
+        }
+        if (resolution < 2 || !(keyframe_interval > 0.0f))
+        {
+            std::cout << "Invalid force field keyframes: resolution " << resolution << ", interval " << keyframe_interval << std::endl;
+            return false;
+        }
+        file_.open(path, std::ios::binary | std::ios::trunc);
+        if (!file_.is_open())
+        {
+            std::cout << "Failed to open force field keyframe file: " << path << std::endl;
+            return false;
+        }
+        std::copy(k_force_field_keyframe_magic, k_force_field_keyframe_magic + 4, header_.magic);
+        header_.version = k_force_field_keyframe_version;
+        header_.resolution = resolution;
+        header_.num_keyframe = 0;
+        header_.keyframe_interval = keyframe_interval;
+        path_ = path;
+        if (!file_.write(reinterpret_cast<const char *>(&header_), sizeof(header_)))
+        {
+            std::cout << "Failed to write force field keyframe file: " << path << std::endl;
+            file_.close();
+            return false;
+        }
+        return true;
+    }
+
+    // grid must have the resolution passed to open()
+    bool append(const ForceFieldGrid &grid)
+    {
+        const std::vector<glm::vec3> &samples = grid.get_samples();
+        if (grid.get_resolution() != header_.resolution
+            || !file_.write(reinterpret_cast<const char *>(samples.data()), samples.size() * sizeof(glm::vec3)))
+        {
+            std::cout << "Failed to write force field keyframe " << header_.num_keyframe << " to " << path_ << std::endl;
+            return false;
+        }
+        header_.num_keyframe++;
+        return true;
+    }
+
+    // Writes the final keyframe count into the header; false if that or the flush fails.
+    bool close()
+    {
+        if (!file_.is_open()) return true;
+        file_.seekp(0);
+        file_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+        file_.close();
+        if (file_.fail())
+        {
+            std::cout << "Failed to write force field keyframe file: " << path_ << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    ~ForceFieldKeyframeWriter() { close(); };
+};
+
+// Time-varying field read from a keyframe file mapped into memory: samples come
+// straight from the mapping, blended between the two keyframes around the current
+// simulation time. The keyframe after that pair is handed to the kernel for
+// readahead (MADV_WILLNEED) as soon as the pair is entered, so crossing a keyframe
+// boundary does not wait on the disk.
+class KeyframedForceFieldGrid
+{
+private:
+    const char *map_;
+    size_t size_;
+    ForceFieldKeyframeHeader header_;
+    float cell_size_;
+    const glm::vec3 *frames_[2];
+    int prefetched_;        // keyframes up to this one have been prefetched
+    float blend_;
+
+public:
+    KeyframedForceFieldGrid()
+    : map_(NULL)
+    , size_(0)
+    , cell_size_(0.0f)
+    , frames_{NULL, NULL}
+    , prefetched_(-1)
+    , blend_(0.0f)
+    {
+    };
+
+    bool open(const std::string &path)
+    {
+        if (!is_little_endian())
+        {
+            std::cout << "Force field keyframes are only supported on little-endian hosts" << std::endl;
+            return false;
+        }
+        if (!read_force_field_keyframe_header(path, header_)) return false;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cout << "Failed to open force field keyframe file: " << path << std::endl;
+            return false;
+        }
+        size_t size = sizeof(header_) + header_.num_keyframe * force_field_keyframe_bytes(header_.resolution);
+        void *map = ::mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+        {
+            std::cout << "Failed to map force field keyframe file: " << path << std::endl;
+            return false;
+        }
+        close();
+        map_ = static_cast<const char *>(map);
+        size_ = size;
+        cell_size_ = (float)k_world_edge_size / (header_.resolution - 1);
+        prefetched_ = -1;
+        advance_to(0.0f);
+        return true;
+    }
+
+    // Fields past the last keyframe hold its value.
+    void advance_to(float simulation_time)
+    {
+        const int last = header_.num_keyframe - 1;
+        float f = std::max(simulation_time / header_.keyframe_interval, 0.0f);
+        int k0 = std::min((int)f, last);
+        int k1 = std::min(k0 + 1, last);
+        blend_ = (k0 == k1) ? 0.0f : f - k0;
+        frames_[0] = keyframe(k0);
+        frames_[1] = keyframe(k1);
+
+        for (int k = std::max(k0, prefetched_ + 1); k <= std::min(k1 + 1, last); k++) prefetch(k);
+        prefetched_ = std::max(prefetched_, std::min(k1 + 1, last));
+    }
+
+    inline glm::vec3 sample(const glm::vec3 &pos) const
+    {
+        glm::vec3 a = ForceFieldGrid::sample(frames_[0], header_.resolution, cell_size_, pos);
+        if (blend_ == 0.0f) return a;
+        return a + (ForceFieldGrid::sample(frames_[1], header_.resolution, cell_size_, pos) - a) * blend_;
+    }
+
+    void close()
+    {
+        if (map_) ::munmap((void *)map_, size_);
+        map_ = NULL;
+        size_ = 0;
+        frames_[0] = frames_[1] = NULL;
+    }
+
+    ~KeyframedForceFieldGrid() { close(); };
+
+private:
+    const glm::vec3 *keyframe(int k) const
+    {
+        return reinterpret_cast<const glm::vec3 *>(map_ + sizeof(header_) + k * force_field_keyframe_bytes(header_.resolution));
+    }
+
+    void prefetch(int k)
+    {
+        const size_t page = ::sysconf(_SC_PAGESIZE);
+        const size_t begin = (sizeof(header_) + k * force_field_keyframe_bytes(header_.resolution)) / page * page;
+        const size_t end = sizeof(header_) + (k + 1) * force_field_keyframe_bytes(header_.resolution);
+        ::madvise((void *)(map_ + begin), end - begin, MADV_WILLNEED);
+    }
+};
+
+#endif // FORCE_FIELD_GRID_HPP_
@@ -0,0 +1,59 @@
+#ifndef FORCE_FIELD_KEYFRAME_HPP_
+#define FORCE_FIELD_KEYFRAME_HPP_
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+
+// Keyframe file layout (little-endian):
+//   header   { char magic[4] = "FFKG"; uint32 version; uint32 resolution; uint32 num_keyframe; float keyframe_interval; }
+//   keyframe { float samples[resolution^3][3]; } * num_keyframe
+// Written by ForceFieldKeyframeWriter and read by KeyframedForceFieldGrid (force_field_grid.hpp).
+// Kept apart from them so apply_simulation_config() can check a `force_field` file.
+const char k_force_field_keyframe_magic[4] = {'F', 'F', 'K', 'G'};
+const uint32_t k_force_field_keyframe_version = 1;
+
+struct ForceFieldKeyframeHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t resolution;
+    uint32_t num_keyframe;
+    float keyframe_interval;    // sec
+};
+
+inline uint64_t force_field_keyframe_bytes(uint32_t resolution)
+{
+    return (uint64_t)resolution * resolution * resolution * 3 * sizeof(float);
+}
+
+// Reads the header of path and checks it describes a complete file; prints why not.
+inline bool read_force_field_keyframe_header(const std::string &path, ForceFieldKeyframeHeader &h)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open force field keyframe file: " << path << std::endl;
+        return false;
+    }
+    const uint64_t file_size = file.tellg();
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(&h), sizeof(h));
+    if (!file || !std::equal(h.magic, h.magic + 4, k_force_field_keyframe_magic)
+        || h.version != k_force_field_keyframe_version || h.num_keyframe == 0
+        || h.resolution < 2 || !(h.keyframe_interval > 0.0f))
+    {
+        std::cout << "Invalid force field keyframe file: " << path << std::endl;
+        return false;
+    }
+    if (file_size < sizeof(h) + h.num_keyframe * force_field_keyframe_bytes(h.resolution))
+    {
+        std::cout << "Truncated force field keyframe file: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+#endif // FORCE_FIELD_KEYFRAME_HPP_
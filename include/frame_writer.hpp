@@ -0,0 +1,433 @@
+#ifndef FRAME_WRITER_HPP_
+#define FRAME_WRITER_HPP_
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "common.hpp"
+#include "particle.hpp"
+
+// Compact per-frame archive of position / velocity / density.
+//
+// Each channel is quantized to 16 bits:
+//   position  fixed point over [0, world_edge_size]
+//   velocity  fixed point over [-velocity_scale, velocity_scale] (per frame)
+//   density   fixed point over [density_min, density_min + density_range] (per frame)
+// and, except on key frames, stored as the wrapped difference to the last quantized
+// value written for the same particle slot (0 if none), zigzag + LEB128 varint coded.
+// Slow-moving particles therefore cost about one byte per channel. A frame holds the
+// first frame_header.num_particle slots.
+//
+// Layout (little-endian):
+//   file_header
+//   { frame_header, uint8 payload[frame_header.payload_bytes] } * n
+namespace frame_record
+{
+
+const char k_magic[4] = {'S', 'P', 'H', 'F'};
+const uint32_t k_version = 2;     // 2: per-frame particle count
+const unsigned int k_num_channel = 7;           // pos xyz, vel xyz, density
+const unsigned int k_keyframe_interval = 30;    // frames
+const unsigned int k_max_queued_frame = 8;      // push() waits for the writer beyond this
+
+struct file_header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t num_particle;          // capacity; frames hold up to this many
+    int32_t world_edge_size;
+    uint32_t keyframe_interval;
+};
+
+struct frame_header
+{
+    uint32_t frame_index;
+    uint32_t is_keyframe;
+    float simulation_time;
+    float velocity_scale;
+    float density_min;
+    float density_range;
+    uint32_t num_particle;
+    uint32_t payload_bytes;
+};
+
+inline uint16_t quantize(float v, float lo, float range)
+{
+    float t = (range > 0.0f) ? (v - lo) / range : 0.0f;
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    return (uint16_t)std::lround(t * 65535.0f);
+}
+
+inline float dequantize(uint16_t q, float lo, float range)
+{
+    return lo + (q / 65535.0f) * range;
+}
+
+inline void put_varint(std::vector<uint8_t> &out, int16_t delta)
+{
+    uint32_t z = ((uint32_t)(int32_t)delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+    while (z >= 0x80)
+    {
+        out.push_back((uint8_t)(z | 0x80));
+        z >>= 7;
+    }
+    out.push_back((uint8_t)z);
+}
+
+const unsigned int k_max_varint_bytes = 3;      // a 16-bit zigzag value
+
+// Decodes one value from [p, end) and advances p; false if the varint runs past end
+// or past k_max_varint_bytes.
+inline bool get_varint(const uint8_t *&p, const uint8_t *end, int16_t &delta)
+{
+    uint32_t z = 0;
+    for (unsigned int b = 0; b < k_max_varint_bytes && p < end; b++)
+    {
+        const uint8_t byte = *p++;
+        z |= (uint32_t)(byte & 0x7f) << (7 * b);
+        if (!(byte & 0x80))
+        {
+            delta = (int16_t)((z >> 1) ^ (~(z & 1) + 1));
+            return true;
+        }
+    }
+    return false;
+}
+
+// raw copy handed from the simulation thread to the writer thread
+struct raw_frame
+{
+    float simulation_time;
+    std::vector<glm::vec3> position;
+    std::vector<glm::vec3> velocity;
+    std::vector<float> density;
+};
+
+} // namespace frame_record
+
+
+class FrameWriter
+{
+private:
+    std::ofstream file_;
+    std::thread worker_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable cv_space_;
+    std::deque<frame_record::raw_frame *> queue_;
+    std::vector<frame_record::raw_frame *> free_;
+    bool closing_;
+    bool failed_;           // a write failed; later frames are dropped
+    std::string path_;
+
+    // writer-thread state
+    uint32_t frame_index_;
+    std::vector<uint16_t> previous_;
+    std::vector<uint16_t> current_;
+    std::vector<uint8_t> payload_;
+
+public:
+    FrameWriter()
+    : closing_(false)
+    , failed_(false)
+    , frame_index_(0)
+    {
+    };
+
+    bool open(const std::string &path)
+    {
+        if (!is_little_endian())
+        {
+            std::cout << "Frame records are only supported on little-endian hosts" << std::endl;
+            return false;
+        }
+        file_.open(path, std::ios::binary | std::ios::trunc);
+        if (!file_.is_open())
+        {
+            std::cout << "Failed to open frame record file: " << path << std::endl;
+            return false;
+        }
+        frame_record::file_header h;
+        std::memcpy(h.magic, frame_record::k_magic, sizeof(h.magic));
+        h.version = frame_record::k_version;
+        h.num_particle = k_num_particle_capacity;
+        h.world_edge_size = k_world_edge_size;
+        h.keyframe_interval = frame_record::k_keyframe_interval;
+        if (!file_.write(reinterpret_cast<const char *>(&h), sizeof(h)))
+        {
+            std::cout << "Failed to write frame record file: " << path << std::endl;
+            file_.close();
+            return false;
+        }
+
+        path_ = path;
+        failed_ = false;
+        frame_index_ = 0;
+        previous_.assign(k_num_particle_capacity * frame_record::k_num_channel, 0);
+        current_.resize(k_num_particle_capacity * frame_record::k_num_channel);
+        closing_ = false;
+        worker_ = std::thread(&FrameWriter::consume, this);
+        return true;
+    }
+
+    // Called from the simulation loop; copies the particle state and returns
+    // without waiting for encoding or I/O, unless k_max_queued_frame frames are
+    // already waiting, in which case it blocks until the writer catches up.
+    void push(Particle &particles, float simulation_time)
+    {
+        frame_record::raw_frame *frame = NULL;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty())
+            {
+                frame = free_.back();
+                free_.pop_back();
+            }
+        }
+        if (!frame) frame = new frame_record::raw_frame();
+
+        frame->simulation_time = simulation_time;
+        const unsigned int n = particles.get_num_active();
+        frame->position.assign(particles.position.begin(), particles.position.begin() + n);
+        frame->velocity.assign(particles.velocity.begin(), particles.velocity.begin() + n);
+        frame->density.assign(particles.density.begin(), particles.density.begin() + n);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_space_.wait(lock, [this] { return queue_.size() < frame_record::k_max_queued_frame; });
+            queue_.push_back(frame);
+        }
+        cv_.notify_one();
+    }
+
+    // Drains the queue and closes the file; false if any write failed.
+    bool close()
+    {
+        if (!worker_.joinable()) return !failed_;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closing_ = true;
+        }
+        cv_.notify_one();
+        worker_.join();
+        file_.close();      // flushes the last buffered frames
+        if (!failed_ && file_.fail())
+        {
+            std::cout << "Failed to write frame record file: " << path_ << std::endl;
+            failed_ = true;
+        }
+        for (frame_record::raw_frame *f : free_) delete f;
+        free_.clear();
+        return !failed_;
+    }
+
+    ~FrameWriter() { close(); };
+
+private:
+    void consume()
+    {
+        while (true)
+        {
+            frame_record::raw_frame *frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return closing_ || !queue_.empty(); });
+                if (queue_.empty()) return;
+                frame = queue_.front();
+                queue_.pop_front();
+            }
+            cv_space_.notify_one();
+
+            if (!failed_) encode(*frame);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_.push_back(frame);
+        }
+    }
+
+    void encode(const frame_record::raw_frame &frame)
+    {
+        const unsigned int n = frame.position.size();
+        const unsigned int c = frame_record::k_num_channel;
+
+        frame_record::frame_header h;
+        h.frame_index = frame_index_;
+        h.is_keyframe = (frame_index_ % frame_record::k_keyframe_interval) == 0;
+        h.simulation_time = frame.simulation_time;
+        h.num_particle = n;
+
+        float v_max = 0.0f;
+        float d_min = frame.density.empty() ? 0.0f : frame.density[0];
+        float d_max = d_min;
+        for (unsigned int i = 0; i < n; i++)
+        {
+            for (int a = 0; a < 3; a++) v_max = std::max(v_max, std::abs(frame.velocity[i][a]));
+            d_min = std::min(d_min, frame.density[i]);
+            d_max = std::max(d_max, frame.density[i]);
+        }
+        h.velocity_scale = v_max;
+        h.density_min = d_min;
+        h.density_range = d_max - d_min;
+
+        for (unsigned int i = 0; i < n; i++)
+        {
+            uint16_t *q = &current_[i * c];
+            for (int a = 0; a < 3; a++)
+            {
+                q[a]     = frame_record::quantize(frame.position[i][a], 0.0f, (float)k_world_edge_size);
+                q[3 + a] = frame_record::quantize(frame.velocity[i][a], -v_max, 2.0f * v_max);
+            }
+            q[6] = frame_record::quantize(frame.density[i], h.density_min, h.density_range);
+        }
+
+        payload_.clear();
+        for (unsigned int k = 0; k < n * c; k++)
+        {
+            uint16_t base = h.is_keyframe ? 0 : previous_[k];
+            frame_record::put_varint(payload_, (int16_t)(uint16_t)(current_[k] - base));
+        }
+        h.payload_bytes = payload_.size();
+
+        if (!file_.write(reinterpret_cast<const char *>(&h), sizeof(h))
+            || !file_.write(reinterpret_cast<const char *>(payload_.data()), payload_.size()))
+        {
+            std::cout << "Failed to write frame record file: " << path_ << " (frame " << frame_index_ << ")" << std::endl;
+            failed_ = true;
+            return;
+        }
+
+        std::copy(current_.begin(), current_.begin() + n * c, previous_.begin());
+        frame_index_++;
+    }
+};
+
+
+// Decodes a FrameWriter archive one frame at a time, in order (frames other than
+// key frames are stored as differences to the previous one). Values come back
+// quantized: positions to world_edge_size / 65535, velocities to
+// 2 velocity_scale / 65535 and densities to density_range / 65535.
+class FrameReader
+{
+public:
+    struct frame
+    {
+        uint32_t frame_index;
+        float simulation_time;
+        std::vector<glm::vec3> position;
+        std::vector<glm::vec3> velocity;
+        std::vector<float> density;
+    };
+
+private:
+    std::ifstream file_;
+    std::string path_;
+    frame_record::file_header header_;
+    std::vector<uint16_t> previous_;
+    std::vector<uint8_t> payload_;
+
+public:
+    FrameReader() {};
+
+    bool open(const std::string &path)
+    {
+        if (!is_little_endian())
+        {
+            std::cout << "Frame records are only supported on little-endian hosts" << std::endl;
+            return false;
+        }
+        file_.open(path, std::ios::binary);
+        if (!file_.is_open())
+        {
+            std::cout << "Failed to open frame record file: " << path << std::endl;
+            return false;
+        }
+        if (!file_.read(reinterpret_cast<char *>(&header_), sizeof(header_))
+            || std::memcmp(header_.magic, frame_record::k_magic, sizeof(header_.magic)) != 0
+            || header_.version != frame_record::k_version)
+        {
+            std::cout << "Not a version " << frame_record::k_version << " frame record: " << path << std::endl;
+            file_.close();
+            return false;
+        }
+        path_ = path;
+        previous_.assign((size_t)header_.num_particle * frame_record::k_num_channel, 0);
+        return true;
+    }
+
+    unsigned int get_num_particle_capacity() const { return header_.num_particle; }
+    int get_world_edge_size() const { return header_.world_edge_size; }
+
+    // Decodes the next frame into out; false at the end of the file. A truncated
+    // or corrupt frame is reported and also ends the stream.
+    bool read(frame &out)
+    {
+        frame_record::frame_header h;
+        if (!file_.read(reinterpret_cast<char *>(&h), sizeof(h))) return false;
+
+        const unsigned int c = frame_record::k_num_channel;
+        if (h.num_particle > header_.num_particle || h.payload_bytes > (size_t)h.num_particle * c * frame_record::k_max_varint_bytes)
+        {
+            std::cout << "Corrupt frame record: " << path_ << " (frame " << h.frame_index << ")" << std::endl;
+            return false;
+        }
+        payload_.resize(h.payload_bytes);
+        if (!file_.read(reinterpret_cast<char *>(payload_.data()), h.payload_bytes))
+        {
+            std::cout << "Truncated frame record: " << path_ << " (frame " << h.frame_index << ")" << std::endl;
+            return false;
+        }
+
+        const unsigned int n = h.num_particle;
+        const uint8_t *p = payload_.data();
+        const uint8_t *end = p + h.payload_bytes;
+        bool ok = true;
+        for (unsigned int k = 0; k < n * c && ok; k++)
+        {
+            int16_t delta = 0;
+            ok = frame_record::get_varint(p, end, delta);
+            uint16_t base = h.is_keyframe ? 0 : previous_[k];
+            previous_[k] = (uint16_t)(base + (uint16_t)delta);
+        }
+        if (!ok || p != end)
+        {
+            std::cout << "Corrupt frame record: " << path_ << " (frame " << h.frame_index << ")" << std::endl;
+            return false;
+        }
+
+        out.frame_index = h.frame_index;
+        out.simulation_time = h.simulation_time;
+        out.position.resize(n);
+        out.velocity.resize(n);
+        out.density.resize(n);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            const uint16_t *q = &previous_[i * c];
+            for (int a = 0; a < 3; a++)
+            {
+                out.position[i][a] = frame_record::dequantize(q[a], 0.0f, (float)header_.world_edge_size);
+                out.velocity[i][a] = frame_record::dequantize(q[3 + a], -h.velocity_scale, 2.0f * h.velocity_scale);
+            }
+            out.density[i] = frame_record::dequantize(q[6], h.density_min, h.density_range);
+        }
+        return true;
+    }
+
+    void close() { file_.close(); }
+
+    ~FrameReader() {};
+};
+
+#endif // FRAME_WRITER_HPP_
@@ -0,0 +1,183 @@
+#ifndef HEADLESS_RUNNER_HPP_
+#define HEADLESS_RUNNER_HPP_
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+#include "common.hpp"
+#include "timer.hpp"
+#include "solver.hpp"
+#include "checkpoint.hpp"
+#include "frame_writer.hpp"
+#include "particle_exporter.hpp"
+#include "surface_mesher.hpp"
+#include "trajectory.hpp"
+
+struct HeadlessOptions
+{
+    unsigned long max_step = 0;     // 0: unlimited
+    float max_time = 0.0f;          // sec, measured from t = 0 (not from the resume point); 0: unlimited
+    float report_interval = 1.0f;   // sec of simulated time between progress lines / recorded frames
+
+    std::string resume_path;        // load the initial state from this checkpoint
+    std::string checkpoint_path;    // save the final state to this checkpoint
+    std::string record_path;        // archive every reported frame (FrameWriter)
+    std::string trajectory_path;    // positions of every reported frame, for replay in the Renderer
+    std::string profile_prefix;     // per-phase timings to <prefix>.csv / <prefix>.json
+    std::string export_pattern;     // printf pattern with the frame number, e.g. out_%04d.vtu (ParticleExporter)
+    std::string mesh_pattern;       // printf pattern with the frame number, e.g. surface_%04d.obj (SurfaceMesher)
+    bool counters = false;          // per-phase hardware counters (PerfCounters), if the kernel allows
+};
+
+// Drives the Solver without a window or GL context.
+// The run stops after max_step steps or max_time simulated seconds, whichever comes
+// first; k_max_display_time always applies.
+class HeadlessRunner
+{
+private:
+    Timer timer;
+    Solver solver;
+
+    unsigned long step_;
+
+public:
+    HeadlessRunner()
+    : step_(0)
+    {
+    };
+
+    bool run(const HeadlessOptions &options)
+    {
+        timer.reset(options.report_interval);
+        step_ = 0;
+
+        uint64_t resumed_step = 0;
+        if (!options.resume_path.empty())
+        {
+            if (!checkpoint::load(options.resume_path, solver.get_particles(), solver.get_rigid_bodies(), timer, resumed_step)) return false;
+            std::cout << "resumed from " << options.resume_path << " at sim_time " << timer.get_simluation_time() << " s" << std::endl;
+        }
+
+        FrameWriter frame_writer;
+        if (!options.record_path.empty())
+        {
+            if (!frame_writer.open(options.record_path)) return false;
+            frame_writer.push(solver.get_particles(), timer.get_simluation_time());
+        }
+
+        TrajectoryWriter trajectory_writer;
+        if (!options.trajectory_path.empty())
+        {
+            if (!trajectory_writer.open(options.trajectory_path)) return false;
+            if (!trajectory_writer.append(solver.get_particles().position.data(), solver.get_particles().get_num_active(), timer.get_simluation_time())) return false;
+        }
+
+        ParticleExporter exporter;
+        unsigned int export_frame = 0;
+        ParticleExporter::format export_format;
+        if (!options.export_pattern.empty() && !ParticleExporter::format_from_path(options.export_pattern, export_format))
+        {
+            std::cout << "Unknown export format: " << options.export_pattern << std::endl;
+            return false;
+        }
+
+        SurfaceMesher mesher;
+        unsigned int mesh_frame = 0;
+
+        if (options.counters) solver.get_profiler().enable_counters();
+
+        auto t_begin = std::chrono::steady_clock::now();
+        auto t_report = t_begin;
+        unsigned long step_report = 0;
+        double particle_updates = 0.0;
+        bool written = true;    // every trajectory / export / mesh frame so far; the run stops at the first failure
+
+        while (written && !timer.is_time_to_stop()
+            && (options.max_step == 0 || step_ < options.max_step)
+            && (options.max_time <= 0.0f || timer.get_simluation_time() < options.max_time))
+        {
+            solver.compute_next_state();
+            timer.update_simulation_time();
+            step_++;
+            particle_updates += solver.get_particles().get_num_active();
+
+            if (timer.is_time_to_draw())
+            {
+                timer.update_next_display_time();
+                if (!options.record_path.empty())
+                {
+                    frame_writer.push(solver.get_particles(), timer.get_simluation_time());
+                }
+                if (!options.trajectory_path.empty())
+                {
+                    written = trajectory_writer.append(solver.get_particles().position.data(), solver.get_particles().get_num_active(), timer.get_simluation_time()) && written;
+                }
+                if (!options.export_pattern.empty())
+                {
+                    char path[4096];
+                    std::snprintf(path, sizeof(path), options.export_pattern.c_str(), export_frame++);
+                    written = exporter.write(path, solver.get_particles()) && written;
+                }
+                if (!options.mesh_pattern.empty())
+                {
+                    char path[4096];
+                    std::snprintf(path, sizeof(path), options.mesh_pattern.c_str(), mesh_frame++);
+                    written = mesher.write_obj(path, solver.get_particles()) && written;
+                }
+
+                auto t_now = std::chrono::steady_clock::now();
+                double wall = std::chrono::duration<double>(t_now - t_report).count();
+                std::cout << "step " << resumed_step + step_
+                          << "  sim_time " << timer.get_simluation_time() << " s"
+                          << "  " << (step_ - step_report) / wall << " steps/s" << std::endl;
+                t_report = t_now;
+                step_report = step_;
+            }
+        }
+
+        double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_begin).count();
+        std::cout << "done: " << step_ << " steps, "
+                  << timer.get_simluation_time() << " s simulated in " << total << " s wall ("
+                  << step_ / total << " steps/s, "
+                  << particle_updates / total << " particle-updates/s)" << std::endl;
+
+        const bool recorded = frame_writer.close();   // reports a failed write itself
+
+        const std::vector<RigidBodySystem::body> &bodies = solver.get_rigid_bodies().get_bodies();
+        for (unsigned int k = 0; k < bodies.size(); k++)
+        {
+            const RigidBodySystem::body &b = bodies[k];
+            std::cout << "  rigid body " << k << ": position (" << b.position.x << ", " << b.position.y << ", " << b.position.z
+                      << "), velocity (" << b.velocity.x << ", " << b.velocity.y << ", " << b.velocity.z << ")" << std::endl;
+        }
+
+        PhaseProfiler &phase_profiler = solver.get_profiler();
+        for (int p = 0; p < profiler::num_phase; p++)
+        {
+            profiler::summary ps = phase_profiler.get_summary((profiler::phase)p);
+            std::cout << "  " << profiler::phase_name[p] << ": mean " << ps.mean * 1e3
+                      << " ms, p99 " << ps.p99 * 1e3 << " ms" << std::endl;
+        }
+        std::cout << phase_profiler.format_counters();
+        if (!options.profile_prefix.empty())
+        {
+            phase_profiler.write_csv(options.profile_prefix + ".csv");
+            phase_profiler.write_json(options.profile_prefix + ".json");
+        }
+
+        if (!options.checkpoint_path.empty())
+        {
+            if (!checkpoint::save(options.checkpoint_path, solver.get_particles(), solver.get_rigid_bodies(), timer, resumed_step + step_)) return false;
+            std::cout << "checkpoint written to " << options.checkpoint_path << std::endl;
+        }
+        return recorded && written;
+    }
+
+    unsigned long get_step() { return step_; }
+    Solver &get_solver() { return solver; }
+
+    ~HeadlessRunner() {};
+};
+
+#endif // HEADLESS_RUNNER_HPP_
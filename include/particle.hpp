@@ -3,13 +3,25 @@
 
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <cstdint>
 
 #include <glm/glm.hpp>
 #include <omp.h>
 
 #include "common.hpp"
 #include "rand_generator.hpp"
+#include "particle_sampler.hpp"
 
+// Particle arrays are a pool of k_num_particle_capacity slots. Between steps the
+// active particles always occupy [0, get_num_active()), so solver loops and the
+// neighbour search never see an inactive slot. Within a step, kill() leaves holes
+// on a free-list, spawn() refills them first, and compact() moves particles from
+// the top of the active range into the remaining holes.
+//
+// material_id indexes k_material_table. With more than one material in the scene the
+// solver periodically calls sort_by_cell(), so neighbours of the same material are
+// contiguous in memory and the per-neighbour table lookups stay coherent.
 class Particle
 {
 public:    
@@ -19,57 +31,275 @@ public:
     std::vector<glm::vec3> force;
     std::vector<float> density;
     std::vector<float> pressure;
+    std::vector<glm::vec3> field_velocity;
 
     std::vector<glm::vec3> next_position;    
     std::vector<glm::vec3> next_velocity;
     std::vector<glm::vec3> next_acceleration;
 
-    std::vector<glm::vec3> gl_position;
+    std::vector<uint8_t> material_id;
     std::vector<glm::vec3> gl_color;
 
+    uint64_t solver_step;   // steps taken, drives the emission schedule and the material sort
+
 private:
     RandGenerator rand_generator;
 
+    unsigned int num_active_;
+    unsigned int num_slot_;                 // slots [0, num_slot_) are active or on the free-list
+    std::vector<uint8_t> alive_;
+    std::vector<unsigned int> free_slot_;
+
+    // sort_by_cell() scratch
+    std::vector<std::pair<uint64_t, unsigned int>> sort_key_;
+    std::vector<unsigned int> sort_order_;
+    std::vector<glm::vec3> scratch_vec3_;
+    std::vector<float> scratch_float_;
+    std::vector<uint8_t> scratch_uint8_;
+
 public:
     Particle()
-    : position(k_num_particle)
-    , velocity(k_num_particle)
-    , acceleration(k_num_particle)
-    , force(k_num_particle)
-    , density(k_num_particle)
-    , pressure(k_num_particle)
-    , next_position(k_num_particle)
-    , next_velocity(k_num_particle)
-    , next_acceleration(k_num_particle)   
-    , gl_position(k_num_particle)
-    , gl_color(k_num_particle)
+    : position(k_num_particle_capacity)
+    , velocity(k_num_particle_capacity)
+    , acceleration(k_num_particle_capacity)
+    , force(k_num_particle_capacity)
+    , density(k_num_particle_capacity)
+    , pressure(k_num_particle_capacity)
+    , field_velocity(k_num_particle_capacity)
+    , next_position(k_num_particle_capacity)
+    , next_velocity(k_num_particle_capacity)
+    , next_acceleration(k_num_particle_capacity)   
+    , material_id(k_num_particle_capacity, k_fluid_material)
+    , gl_color(k_num_particle_capacity, k_particle_color)
+    , solver_step(0)
+    , alive_(k_num_particle_capacity, 0)
     {
+        set_num_active(k_scene_preset == scene_preset::empty ? 0 : k_num_particle);
         initialize_particle_state();
     };
     
-    std::vector<glm::vec3> &get_gl_particle_position() 
+    // dst: get_num_active() elements, typically a mapped GL buffer
+    void write_gl_particle_position(glm::vec3 *dst) 
     { 
+        const int n = num_active_;
         #pragma omp parallel for
-        for (int i = 0; i < k_num_particle; i++)
+        for (int i = 0; i < n; i++)
         {
-            gl_position.at(i) = transform_world2gl(position[i]);
+            dst[i] = transform_world2gl(position[i]);
         }
-        return gl_position;
     }
     std::vector<glm::vec3> &get_gl_particle_color() { return gl_color; }
+    RandGenerator &get_rand_generator() { return rand_generator; }
+
+    // Visits every per-particle array as (data, bytes), always in the same order.
+    template <typename F>
+    void for_each_array(F f)
+    {
+        for (std::vector<glm::vec3> *v : {&position, &velocity, &acceleration, &force})
+            f((void *)v->data(), v->size() * sizeof(glm::vec3));
+        for (std::vector<float> *v : {&density, &pressure})
+            f((void *)v->data(), v->size() * sizeof(float));
+        for (std::vector<glm::vec3> *v : {&field_velocity, &next_position, &next_velocity, &next_acceleration, &gl_color})
+            f((void *)v->data(), v->size() * sizeof(glm::vec3));
+        f((void *)material_id.data(), material_id.size() * sizeof(uint8_t));
+    }
+
+    // Pool ---------------------------------------------------------------------//
+    unsigned int get_num_active() const { return num_active_; }
+    unsigned int get_capacity() const { return k_num_particle_capacity; }
+    bool is_compact() const { return free_slot_.empty(); }
+
+    // Marks [0, n) active and every other slot free, e.g. after restoring a checkpoint.
+    void set_num_active(unsigned int n)
+    {
+        num_active_ = num_slot_ = std::min(n, (unsigned int)k_num_particle_capacity);
+        std::fill(alive_.begin(), alive_.begin() + num_active_, 1);
+        std::fill(alive_.begin() + num_active_, alive_.end(), 0);
+        free_slot_.clear();
+    }
+
+    // Activates a slot at rest density; returns its index, or -1 if the pool is full.
+    int spawn(glm::vec3 pos, glm::vec3 vel, material m = k_fluid_material)
+    {
+        unsigned int i;
+        if (!free_slot_.empty())
+        {
+            i = free_slot_.back();
+            free_slot_.pop_back();
+        }
+        else if (num_slot_ < k_num_particle_capacity) i = num_slot_++;
+        else return -1;
+
+        position[i] = next_position[i] = pos;
+        velocity[i] = next_velocity[i] = vel;
+        acceleration[i] = next_acceleration[i] = force[i] = field_velocity[i] = {0.0f, 0.0f, 0.0f};
+        density[i] = k_material_table.rest_density[m];
+        pressure[i] = 0.0f;
+        material_id[i] = m;
+        gl_color[i] = k_material_table.color[m];
+        alive_[i] = 1;
+        num_active_++;
+        return i;
+    }
+
+    void kill(unsigned int i)
+    {
+        if (!alive_[i]) return;
+        alive_[i] = 0;
+        free_slot_.push_back(i);
+        num_active_--;
+    }
+
+    // Fills the holes below num_active with the highest active slots; O(holes).
+    void compact()
+    {
+        if (free_slot_.empty()) return;
+        std::sort(free_slot_.begin(), free_slot_.end());
+        unsigned int top = num_slot_;
+        for (unsigned int hole : free_slot_)
+        {
+            if (hole >= num_active_) break;
+            do { top--; } while (!alive_[top]);
+            move_slot(hole, top);
+        }
+        num_slot_ = num_active_;
+        std::fill(alive_.begin() + num_active_, alive_.end(), 0);
+        free_slot_.clear();
+    }
+
+    // Reorders the active particles by (grid cell of position, material). The pool
+    // must be compact; ties keep their current order, so the result is deterministic.
+    void sort_by_cell(float cell_size)
+    {
+        const int n = num_active_;
+        const uint64_t cells_per_axis = (uint64_t)std::ceil(k_world_edge_size / cell_size) + 1;
+        sort_key_.resize(n);
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t cell = 0;
+            for (int a = 2; a >= 0; a--)
+            {
+                float c = std::floor(position[i][a] / cell_size);
+                cell = cell * cells_per_axis + (uint64_t)std::min(std::max(c, 0.0f), (float)(cells_per_axis - 1));
+            }
+            sort_key_[i] = {cell * k_num_material + material_id[i], (unsigned int)i};
+        }
+        std::sort(sort_key_.begin(), sort_key_.end());
+
+        sort_order_.resize(n);
+        for (int k = 0; k < n; k++) sort_order_[k] = sort_key_[k].second;
+        for (std::vector<glm::vec3> *v : {&position, &velocity, &acceleration, &force, &field_velocity,
+                                          &next_position, &next_velocity, &next_acceleration, &gl_color})
+            gather(*v, scratch_vec3_);
+        for (std::vector<float> *v : {&density, &pressure})
+            gather(*v, scratch_float_);
+        gather(material_id, scratch_uint8_);
+    }
 
     ~Particle() {};
 
 private:
+    void move_slot(unsigned int dst, unsigned int src)
+    {
+        position[dst] = position[src];
+        velocity[dst] = velocity[src];
+        acceleration[dst] = acceleration[src];
+        force[dst] = force[src];
+        density[dst] = density[src];
+        pressure[dst] = pressure[src];
+        field_velocity[dst] = field_velocity[src];
+        next_position[dst] = next_position[src];
+        next_velocity[dst] = next_velocity[src];
+        next_acceleration[dst] = next_acceleration[src];
+        material_id[dst] = material_id[src];
+        gl_color[dst] = gl_color[src];
+        alive_[dst] = 1;
+        alive_[src] = 0;
+    }
+
+    // v[k] = v[sort_order_[k]] over the active range
+    template <typename T>
+    void gather(std::vector<T> &v, std::vector<T> &scratch)
+    {
+        const int n = sort_order_.size();
+        scratch.resize(n);
+        #pragma omp parallel for
+        for (int k = 0; k < n; k++) scratch[k] = v[sort_order_[k]];
+        std::copy(scratch.begin(), scratch.end(), v.begin());
+    }
+
     void initialize_particle_state()
     {
+        const float e = k_world_edge_size;
+        switch (k_scene_preset)
+        {
+            case scene_preset::dam_break:   // water column against the back wall
+                fill_layers({{0, 0, 0}, {0.5f * e, e, e}, false}, 0, k_num_particle);
+                break;
+            case scene_preset::drop:        // sphere falling into a pool holding 80% of the fluid
+            {
+                unsigned int pool = k_num_particle * 4 / 5;
+                float r = e * std::cbrt(0.1f * 3.0f / (4.0f * (float)M_PI));
+                glm::vec3 c = {0.5f * e, 0.5f * e, 0.7f * e};
+                fill_region({{0, 0, 0}, {e, e, 0.4f * e}, false}, 0, pool);
+                fill_region({c - r, c + r, true}, pool, k_num_particle);
+                set_material(pool, k_num_particle, k_secondary_material);
+                break;
+            }
+            case scene_preset::tank:        // lower half of the box, at rest
+                fill_layers({{0, 0, 0}, {e, e, 0.5f * e}, false}, 0, k_num_particle);
+                break;
+            case scene_preset::empty:       // filled by emitters
+                break;
+            default:
+                #pragma omp parallel for
+                for (int i = 0; i < (int)k_num_particle; i++)
+                {
+                    position.at(i) = rand_generator.generate_random_uniform_vec3_at(i, 0, e);
+                    if (k_multi_material && position[i].z > 0.5f * e) set_material(i, i + 1, k_secondary_material);
+                }
+                break;
+        }
+
+        const int n = num_active_;
         #pragma omp parallel for
-        for (int i = 0; i < k_num_particle; i++)
+        for (int i = 0; i < n; i++)
         {
-            gl_color.at(i) = {153/255, 255/255, 255/255};
-            position.at(i) = rand_generator.generate_random_uniform_vec3(0, k_world_edge_size);
             velocity.at(i) = {0.0f, 0.0f, 0.0f};
+            next_position.at(i) = position.at(i);   // the first neighbour search runs on next_position
+        }
+    }
+
+    // Fills box r with [begin, end); with a second material the upper half of the box
+    // holds it, so a heavier secondary fluid starts unstably layered on top.
+    void fill_layers(const particle_sampler::region &r, unsigned int begin, unsigned int end)
+    {
+        if (!k_multi_material)
+        {
+            fill_region(r, begin, end);
+            return;
         }
+        unsigned int middle = begin + (end - begin) / 2;
+        float z = 0.5f * (r.lo.z + r.hi.z);
+        fill_region({r.lo, {r.hi.x, r.hi.y, z}, false}, begin, middle);
+        fill_region({{r.lo.x, r.lo.y, z}, r.hi, false}, middle, end);
+        set_material(middle, end, k_secondary_material);
+    }
+
+    void set_material(unsigned int begin, unsigned int end, material m)
+    {
+        std::fill(material_id.begin() + begin, material_id.begin() + end, m);
+        std::fill(gl_color.begin() + begin, gl_color.begin() + end, k_material_table.color[m]);
+    }
+
+    // Places particles [begin, end) inside r with k_sampling. The presets size their
+    // regions to k_fluid_volume, so either method starts close to rest density.
+    void fill_region(const particle_sampler::region &r, unsigned int begin, unsigned int end)
+    {
+        if (end <= begin) return;
+        if (k_sampling == sampling::poisson_disk) particle_sampler::poisson_disk(r, end - begin, rand_generator, &position[begin], begin);
+        else particle_sampler::lattice(r, end - begin, rand_generator, &position[begin], begin);
     }
 };
 
@@ -0,0 +1,242 @@
+#ifndef PARTICLE_CULLER_HPP_
+#define PARTICLE_CULLER_HPP_
+
+#include <vector>
+#include <mutex>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <omp.h>
+
+// Chooses the sprites to draw for the last camera handed over by the renderer, so the
+// number submitted per frame does not grow with the particle count. Positions (GL
+// coordinates) are binned into a k_num_cell^3 grid over the box with a parallel
+// counting pass, in the spirit of Particle::sort_by_cell(); cells outside the view
+// frustum are dropped. A cell whose sprites would be smaller than min_sprite_pixel
+// across keeps every stride-th of its particles, with the sprite radius scaled by
+// cbrt(stride) so the covered volume and the fluid thickness stay about the same.
+// If the total is still over the budget, the minimum size is raised until it fits.
+//
+// The output is ordered by cell, then by particle index, whatever the thread count;
+// when nothing is dropped it is the input unchanged.
+class ParticleCuller
+{
+public:
+    struct camera
+    {
+        glm::mat4 view_projection;
+        glm::vec3 eye;
+        float point_scale;      // a sprite at distance d is point_scale * radius / d pixels across
+        float radius;           // sprite radius, GL units
+    };
+
+private:
+    static const int k_num_cell = 32;               // per axis over [-1, 1]
+    static const unsigned int k_max_stride = 512;
+
+    float min_sprite_pixel_;    // 0: no level of detail
+    unsigned int budget_;       // 0: no limit
+
+    std::mutex camera_mutex_;
+    camera camera_;
+    bool has_camera_;
+
+    int num_chunk_;                         // contiguous particle ranges, one per thread
+    std::vector<unsigned int> cell_of_;
+    std::vector<unsigned int> count_;       // [chunk][cell], then the rank in the cell of the chunk's first particle
+    std::vector<unsigned int> num_in_cell_;
+    std::vector<unsigned int> stride_;      // per cell, 0: culled
+    std::vector<unsigned int> out_begin_;
+
+public:
+    ParticleCuller()
+    : min_sprite_pixel_(2.0f)
+    , budget_(1u << 22)
+    , has_camera_(false)
+    , num_chunk_(1)
+    , num_in_cell_(k_num_cell * k_num_cell * k_num_cell)
+    , stride_(k_num_cell * k_num_cell * k_num_cell)
+    , out_begin_(k_num_cell * k_num_cell * k_num_cell + 1)
+    {
+    };
+
+    void set_level_of_detail(float min_sprite_pixel, unsigned int budget)
+    {
+        min_sprite_pixel_ = min_sprite_pixel;
+        budget_ = budget;
+    }
+
+    // Render thread; used from the next select() on.
+    void set_camera(const camera &c)
+    {
+        std::lock_guard<std::mutex> lock(camera_mutex_);
+        camera_ = c;
+        has_camera_ = true;
+    }
+
+    // Writes the selected positions, colors (if color is not NULL) and sprite radius
+    // scales and returns how many were selected. out_position must hold n positions; it
+    // may be mapped GPU memory, which is only written. Everything passes until a camera
+    // has been set.
+    unsigned int select(const glm::vec3 *position, const glm::vec3 *color, unsigned int n,
+                        glm::vec3 *out_position, std::vector<glm::vec3> *out_color, std::vector<float> &out_scale)
+    {
+        camera cam;
+        {
+            std::lock_guard<std::mutex> lock(camera_mutex_);
+            if (!has_camera_) return select_all(position, color, n, out_position, out_color, out_scale);
+            cam = camera_;
+        }
+
+        bin(position, n);
+        choose_strides(cam);
+
+        const int num_cell = stride_.size();
+        bool all = true;
+        out_begin_[0] = 0;
+        for (int c = 0; c < num_cell; c++)
+        {
+            const unsigned int count = num_in_cell_[c];
+            all = all && (count == 0 || stride_[c] == 1);
+            out_begin_[c + 1] = out_begin_[c] + (stride_[c] ? (count + stride_[c] - 1) / stride_[c] : 0);
+        }
+        if (all) return select_all(position, color, n, out_position, out_color, out_scale);
+
+        const unsigned int m = out_begin_[num_cell];
+        if (color) out_color->resize(m);
+        out_scale.resize(m);
+
+        // particle i is the r-th of its cell; every stride-th one is kept at out_begin_ + r / stride
+        #pragma omp parallel for schedule(static)
+        for (int t = 0; t < num_chunk_; t++)
+        {
+            unsigned int *rank = &count_[(size_t)t * num_cell];
+            for (unsigned int i = chunk_begin(n, t); i < chunk_begin(n, t + 1); i++)
+            {
+                const unsigned int c = cell_of_[i];
+                const unsigned int r = rank[c]++;
+                if (!stride_[c] || r % stride_[c]) continue;
+                const unsigned int o = out_begin_[c] + r / stride_[c];
+                out_position[o] = position[i];
+                if (color) (*out_color)[o] = color[i];
+                out_scale[o] = std::cbrt((float)stride_[c]);
+            }
+        }
+        return m;
+    }
+
+    ~ParticleCuller() {};
+
+private:
+    unsigned int select_all(const glm::vec3 *position, const glm::vec3 *color, unsigned int n,
+                            glm::vec3 *out_position, std::vector<glm::vec3> *out_color, std::vector<float> &out_scale)
+    {
+        std::copy(position, position + n, out_position);
+        if (color) out_color->assign(color, color + n);
+        out_scale.assign(n, 1.0f);
+        return n;
+    }
+
+    unsigned int chunk_begin(unsigned int n, int t) const { return (uint64_t)n * t / num_chunk_; }
+
+    // Cell of every particle and, per chunk, the rank within each cell of the chunk's
+    // first particle there, so the chunks can be gathered independently.
+    void bin(const glm::vec3 *position, unsigned int n)
+    {
+        const int num_cell = stride_.size();
+        num_chunk_ = omp_get_max_threads();
+        cell_of_.resize(n);
+        count_.assign((size_t)num_chunk_ * num_cell, 0);
+
+        #pragma omp parallel for schedule(static)
+        for (int t = 0; t < num_chunk_; t++)
+        {
+            unsigned int *count = &count_[(size_t)t * num_cell];
+            for (unsigned int i = chunk_begin(n, t); i < chunk_begin(n, t + 1); i++)
+            {
+                unsigned int cell = 0;
+                for (int a = 2; a >= 0; a--)
+                {
+                    int x = (int)std::floor((position[i][a] + 1.0f) * 0.5f * k_num_cell);
+                    cell = cell * k_num_cell + std::min(std::max(x, 0), k_num_cell - 1);
+                }
+                cell_of_[i] = cell;
+                count[cell]++;
+            }
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (int c = 0; c < num_cell; c++)
+        {
+            unsigned int rank = 0;
+            for (int t = 0; t < num_chunk_; t++)
+            {
+                unsigned int k = count_[(size_t)t * num_cell + c];
+                count_[(size_t)t * num_cell + c] = rank;
+                rank += k;
+            }
+            num_in_cell_[c] = rank;
+        }
+    }
+
+    // Per-cell stride for the camera: 0 outside the frustum, otherwise the smallest
+    // power of two keeping the sprites at least min_sprite across (raised for the budget).
+    void choose_strides(const camera &cam)
+    {
+        glm::vec4 plane[6];
+        const glm::mat4 m = glm::transpose(cam.view_projection);   // rows of the matrix
+        for (int a = 0; a < 3; a++)
+        {
+            plane[2 * a] = m[3] + m[a];
+            plane[2 * a + 1] = m[3] - m[a];
+        }
+
+        const int num_cell = stride_.size();
+        const float width = 2.0f / k_num_cell;
+        const float half_diagonal = 0.5f * std::sqrt(3.0f) * width;
+        float min_sprite = min_sprite_pixel_;
+        for (int attempt = 0; attempt < 16; attempt++)
+        {
+            unsigned long total = 0;
+            #pragma omp parallel for schedule(static) reduction(+: total)
+            for (int c = 0; c < num_cell; c++)
+            {
+                stride_[c] = 0;
+                const unsigned int count = num_in_cell_[c];
+                if (!count) continue;
+                const glm::vec3 lo = glm::vec3(c % k_num_cell, (c / k_num_cell) % k_num_cell, c / (k_num_cell * k_num_cell)) * width - 1.0f;
+                const glm::vec3 center = lo + 0.5f * width;
+
+                unsigned int stride = 1;
+                const float distance = std::max(glm::length(center - cam.eye) - half_diagonal, 1e-3f);
+                const float sprite = cam.point_scale * cam.radius / distance;
+                if (min_sprite > 0.0f && sprite < min_sprite)
+                {
+                    const float ratio = min_sprite / sprite;
+                    const float want = std::min(ratio * ratio * ratio, (float)k_max_stride);
+                    while (stride < want) stride *= 2;
+                }
+
+                const float pad = cam.radius * std::cbrt((float)stride);
+                const glm::vec3 box_lo = lo - pad, box_hi = lo + width + pad;
+                bool inside = true;
+                for (int p = 0; p < 6 && inside; p++)
+                {
+                    glm::vec3 v = {plane[p].x >= 0.0f ? box_hi.x : box_lo.x,
+                                   plane[p].y >= 0.0f ? box_hi.y : box_lo.y,
+                                   plane[p].z >= 0.0f ? box_hi.z : box_lo.z};
+                    inside = glm::dot(glm::vec3(plane[p]), v) + plane[p].w >= 0.0f;
+                }
+                if (!inside) continue;
+                stride_[c] = stride;
+                total += (count + stride - 1) / stride;
+            }
+            if (budget_ == 0 || total <= budget_) return;
+            min_sprite = std::max(min_sprite, 1.0f) * 1.26f;    // about twice the stride
+        }
+    }
+};
+
+#endif // PARTICLE_CULLER_HPP_
@@ -0,0 +1,270 @@
+#ifndef PARTICLE_EXPORTER_HPP_
+#define PARTICLE_EXPORTER_HPP_
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <glm/glm.hpp>
+#include <omp.h>
+
+#include "common.hpp"
+#include "particle.hpp"
+
+// Per-frame particle export for ParaView / Houdini.
+//   .vtk  legacy VTK, binary POLYDATA (big-endian, as the format requires)
+//   .vtu  VTK XML UnstructuredGrid, raw appended data in the host byte order
+//   .ply  binary in the host byte order, one vertex element per particle
+// Every format carries position, velocity, density and pressure.
+//
+// The whole file is serialized into a buffer that is reused across frames, with the
+// per-particle part filled in parallel, and handed to the kernel in a single write().
+class ParticleExporter
+{
+private:
+    static const bool k_host_little_endian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+public:
+    enum format
+    {
+        vtk, vtu, ply
+    };
+
+private:
+    std::vector<char> buffer_;
+    size_t size_;
+
+public:
+    ParticleExporter()
+    : size_(0)
+    {
+    };
+
+    // Picks the format from the extension of path; returns false for unknown ones.
+    static bool format_from_path(const std::string &path, format &f)
+    {
+        auto ends_with = [&](const char *ext) {
+            size_t n = std::strlen(ext);
+            return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+        };
+        if (ends_with(".vtk")) f = format::vtk;
+        else if (ends_with(".vtu")) f = format::vtu;
+        else if (ends_with(".ply")) f = format::ply;
+        else return false;
+        return true;
+    }
+
+    bool write(const std::string &path, Particle &particles)
+    {
+        format f;
+        if (!format_from_path(path, f))
+        {
+            std::cout << "Unknown export format: " << path << std::endl;
+            return false;
+        }
+        serialize(f, particles.get_num_active(), particles.position, particles.velocity, particles.density, particles.pressure);
+        return flush(path);
+    }
+
+    // the first n elements of each array
+    void serialize(format f, size_t n, const std::vector<glm::vec3> &position, const std::vector<glm::vec3> &velocity,
+                   const std::vector<float> &density, const std::vector<float> &pressure)
+    {
+        switch (f)
+        {
+            case format::vtk: serialize_vtk(n, position, velocity, density, pressure); break;
+            case format::vtu: serialize_vtu(n, position, velocity, density, pressure); break;
+            case format::ply: serialize_ply(n, position, velocity, density, pressure); break;
+        }
+    }
+
+    bool flush(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            std::cout << "Failed to open export file: " << path << std::endl;
+            return false;
+        }
+        const char *p = buffer_.data();
+        size_t left = size_;
+        while (left > 0)
+        {
+            ssize_t n = ::write(fd, p, left);
+            if (n <= 0) break;
+            p += n;
+            left -= n;
+        }
+        bool ok = (::close(fd) == 0) && left == 0;
+        if (!ok) std::cout << "Failed to write export file: " << path << std::endl;
+        return ok;
+    }
+
+    const char *data() const { return buffer_.data(); }
+    size_t size() const { return size_; }
+
+    ~ParticleExporter() {};
+
+private:
+    char *reserve(size_t size)
+    {
+        if (buffer_.size() < size) buffer_.resize(size);
+        size_ = size;
+        return buffer_.data();
+    }
+
+    static inline void put_f32_be(char *dst, float v)
+    {
+        uint32_t u;
+        std::memcpy(&u, &v, 4);
+        if (k_host_little_endian) u = __builtin_bswap32(u);
+        std::memcpy(dst, &u, 4);
+    }
+
+    static inline void put_i32_be(char *dst, int32_t v)
+    {
+        uint32_t u = k_host_little_endian ? __builtin_bswap32((uint32_t)v) : (uint32_t)v;
+        std::memcpy(dst, &u, 4);
+    }
+
+    void serialize_vtk(size_t num_particle, const std::vector<glm::vec3> &position, const std::vector<glm::vec3> &velocity,
+                       const std::vector<float> &density, const std::vector<float> &pressure)
+    {
+        const long n = num_particle;
+        std::string h_points = "# vtk DataFile Version 3.0\n" + std::string(k_project_name) + "\nBINARY\n"
+                               "DATASET POLYDATA\nPOINTS " + std::to_string(n) + " float\n";
+        std::string h_verts = "\nVERTICES " + std::to_string(n) + " " + std::to_string(2 * n) + "\n";
+        std::string h_density = "\nPOINT_DATA " + std::to_string(n) + "\nSCALARS density float 1\nLOOKUP_TABLE default\n";
+        std::string h_pressure = "\nSCALARS pressure float 1\nLOOKUP_TABLE default\n";
+        std::string h_velocity = "\nVECTORS velocity float\n";
+
+        size_t o_points   = h_points.size();
+        size_t o_verts    = o_points + n * 12 + h_verts.size();
+        size_t o_density  = o_verts + n * 8 + h_density.size();
+        size_t o_pressure = o_density + n * 4 + h_pressure.size();
+        size_t o_velocity = o_pressure + n * 4 + h_velocity.size();
+        char *b = reserve(o_velocity + n * 12 + 1);
+
+        std::memcpy(b, h_points.data(), h_points.size());
+        std::memcpy(b + o_verts - h_verts.size(), h_verts.data(), h_verts.size());
+        std::memcpy(b + o_density - h_density.size(), h_density.data(), h_density.size());
+        std::memcpy(b + o_pressure - h_pressure.size(), h_pressure.data(), h_pressure.size());
+        std::memcpy(b + o_velocity - h_velocity.size(), h_velocity.data(), h_velocity.size());
+        b[size_ - 1] = '\n';
+
+        #pragma omp parallel for
+        for (long i = 0; i < n; i++)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                put_f32_be(b + o_points + i * 12 + a * 4, position[i][a]);
+                put_f32_be(b + o_velocity + i * 12 + a * 4, velocity[i][a]);
+            }
+            put_i32_be(b + o_verts + i * 8, 1);
+            put_i32_be(b + o_verts + i * 8 + 4, (int32_t)i);
+            put_f32_be(b + o_density + i * 4, density[i]);
+            put_f32_be(b + o_pressure + i * 4, pressure[i]);
+        }
+    }
+
+    void serialize_vtu(size_t num_particle, const std::vector<glm::vec3> &position, const std::vector<glm::vec3> &velocity,
+                       const std::vector<float> &density, const std::vector<float> &pressure)
+    {
+        // appended blocks, each prefixed by its uint64 byte count:
+        //   points, velocity, density, pressure, connectivity, offsets, types
+        const uint64_t n = num_particle;
+        const uint64_t block[7] = {n * 12, n * 12, n * 4, n * 4, n * 8, n * 8, n};
+        uint64_t offset[7];
+        uint64_t total = 0;
+        for (int k = 0; k < 7; k++)
+        {
+            offset[k] = total;
+            total += 8 + block[k];
+        }
+
+        auto array = [&](const char *type, const char *name, int components, int k) {
+            return std::string("<DataArray type=\"") + type + "\" Name=\"" + name
+                 + "\" NumberOfComponents=\"" + std::to_string(components)
+                 + "\" format=\"appended\" offset=\"" + std::to_string(offset[k]) + "\"/>\n";
+        };
+        std::string header =
+            "<?xml version=\"1.0\"?>\n"
+            "<VTKFile type=\"UnstructuredGrid\" version=\"1.0\" byte_order=\"" + std::string(k_host_little_endian ? "LittleEndian" : "BigEndian")
+            + "\" header_type=\"UInt64\">\n"
+            "<UnstructuredGrid>\n"
+            "<Piece NumberOfPoints=\"" + std::to_string(n) + "\" NumberOfCells=\"" + std::to_string(n) + "\">\n"
+            "<Points>\n" + array("Float32", "position", 3, 0) + "</Points>\n"
+            "<PointData Scalars=\"density\" Vectors=\"velocity\">\n"
+            + array("Float32", "velocity", 3, 1) + array("Float32", "density", 1, 2) + array("Float32", "pressure", 1, 3) +
+            "</PointData>\n"
+            "<Cells>\n"
+            + array("Int64", "connectivity", 1, 4) + array("Int64", "offsets", 1, 5) + array("UInt8", "types", 1, 6) +
+            "</Cells>\n"
+            "</Piece>\n"
+            "</UnstructuredGrid>\n"
+            "<AppendedData encoding=\"raw\">\n_";
+        std::string footer = "\n</AppendedData>\n</VTKFile>\n";
+
+        char *b = reserve(header.size() + total + footer.size());
+        std::memcpy(b, header.data(), header.size());
+        char *data = b + header.size();
+        std::memcpy(data + total, footer.data(), footer.size());
+
+        char *blk[7];
+        for (int k = 0; k < 7; k++)
+        {
+            std::memcpy(data + offset[k], &block[k], 8);
+            blk[k] = data + offset[k] + 8;
+        }
+
+        #pragma omp parallel for
+        for (long i = 0; i < (long)n; i++)
+        {
+            std::memcpy(blk[0] + i * 12, &position[i][0], 12);
+            std::memcpy(blk[1] + i * 12, &velocity[i][0], 12);
+            std::memcpy(blk[2] + i * 4, &density[i], 4);
+            std::memcpy(blk[3] + i * 4, &pressure[i], 4);
+            int64_t id = i, end = i + 1;
+            std::memcpy(blk[4] + i * 8, &id, 8);
+            std::memcpy(blk[5] + i * 8, &end, 8);
+            blk[6][i] = 1;  // VTK_VERTEX
+        }
+    }
+
+    void serialize_ply(size_t num_particle, const std::vector<glm::vec3> &position, const std::vector<glm::vec3> &velocity,
+                       const std::vector<float> &density, const std::vector<float> &pressure)
+    {
+        const long n = num_particle;
+        std::string header =
+            "ply\nformat " + std::string(k_host_little_endian ? "binary_little_endian" : "binary_big_endian") + " 1.0\n"
+            "element vertex " + std::to_string(n) + "\n"
+            "property float x\nproperty float y\nproperty float z\n"
+            "property float vx\nproperty float vy\nproperty float vz\n"
+            "property float density\nproperty float pressure\n"
+            "end_header\n";
+        const size_t stride = 8 * sizeof(float);
+
+        char *b = reserve(header.size() + n * stride);
+        std::memcpy(b, header.data(), header.size());
+        char *body = b + header.size();
+
+        #pragma omp parallel for
+        for (long i = 0; i < n; i++)
+        {
+            float record[8] = {
+                position[i][0], position[i][1], position[i][2],
+                velocity[i][0], velocity[i][1], velocity[i][2],
+                density[i], pressure[i]
+            };
+            std::memcpy(body + i * stride, record, stride);
+        }
+    }
+};
+
+#endif // PARTICLE_EXPORTER_HPP_
@@ -0,0 +1,110 @@
+#ifndef PARTICLE_SAMPLER_HPP_
+#define PARTICLE_SAMPLER_HPP_
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+#include <omp.h>
+#include <cyCodeBase/cySampleElim.h>
+
+#include "common.hpp"
+#include "rand_generator.hpp"
+
+// Initial particle placement inside a fluid region at (close to) rest spacing, so a
+// scene starts near rest density instead of settling from random clumps.
+//   lattice       cubic lattice with spacing cbrt(volume / count), filled bottom-up
+//   poisson_disk  blue noise: weighted sample elimination (cySampleElim) of 5x
+//                 uniform candidates
+// A region is any type with lo / hi bounds, contains(p) and volume().
+namespace particle_sampler
+{
+
+// Axis-aligned box lo..hi, or the ellipsoid inscribed in it.
+struct region
+{
+    glm::vec3 lo;
+    glm::vec3 hi;
+    bool ellipsoid;
+
+    bool contains(glm::vec3 p) const
+    {
+        if (!ellipsoid)
+        {
+            for (int a = 0; a < 3; a++) if (p[a] < lo[a] || p[a] > hi[a]) return false;
+            return true;
+        }
+        glm::vec3 d = (p - 0.5f * (lo + hi)) / (0.5f * (hi - lo));
+        return glm::dot(d, d) <= 1.0f;
+    }
+
+    float volume() const
+    {
+        glm::vec3 e = hi - lo;
+        return e.x * e.y * e.z * (ellipsoid ? (float)M_PI / 6.0f : 1.0f);
+    }
+};
+
+// Writes count positions to out. first_index offsets the per-particle random streams,
+// so several regions filled into one array draw independent jitter.
+template <typename Region>
+void lattice(const Region &r, unsigned int count, const RandGenerator &rng, glm::vec3 *out, unsigned int first_index = 0)
+{
+    if (count == 0) return;
+    glm::vec3 extent = r.hi - r.lo;
+    float h = std::cbrt(r.volume() / count);
+
+    // shrink the spacing until the region holds enough lattice points
+    std::vector<glm::vec3> points;
+    while (true)
+    {
+        int n[3];
+        for (int a = 0; a < 3; a++) n[a] = std::max(1, (int)(extent[a] / h));
+        glm::vec3 origin = r.lo + 0.5f * (extent - h * glm::vec3(n[0] - 1, n[1] - 1, n[2] - 1));
+
+        points.clear();
+        for (int z = 0; z < n[2]; z++)
+            for (int y = 0; y < n[1]; y++)
+                for (int x = 0; x < n[0]; x++)
+                {
+                    glm::vec3 p = origin + h * glm::vec3(x, y, z);
+                    if (r.contains(p)) points.push_back(p);
+                }
+        if (points.size() >= count) break;
+        h *= points.empty() ? 0.5f : 0.99f * std::cbrt((float)points.size() / count);
+    }
+
+    // bottom layers first; jitter by up to 1% of the spacing to break the symmetry
+    #pragma omp parallel for
+    for (int k = 0; k < (int)count; k++)
+    {
+        out[k] = points[k] + rng.generate_random_uniform_vec3_at(first_index + k, -0.01f * h, 0.01f * h, 1);
+    }
+}
+
+template <typename Region>
+void poisson_disk(const Region &r, unsigned int count, const RandGenerator &rng, glm::vec3 *out, unsigned int first_index = 0)
+{
+    if (count == 0) return;
+    const unsigned int num_candidate = 5 * count;
+
+    std::vector<glm::vec3> candidate;
+    candidate.reserve(num_candidate);
+    for (uint64_t j = 0; candidate.size() < num_candidate; j++)
+    {
+        glm::vec3 t = rng.generate_random_uniform_vec3_at(((uint64_t)first_index << 32) + j, 0.0f, 1.0f, 2);
+        glm::vec3 p = r.lo + t * (r.hi - r.lo);
+        if (r.contains(p)) candidate.push_back(p);
+    }
+
+    cy::WeightedSampleElimination<glm::vec3, float, 3, unsigned int> wse;
+    wse.SetBoundsMin(r.lo);
+    wse.SetBoundsMax(r.hi);
+    float d_max = 2.0f * wse.GetMaxPoissonDiskRadius(3, count, r.volume());
+    wse.Eliminate(candidate.data(), num_candidate, out, count, false, d_max, 3);
+}
+
+} // namespace particle_sampler
+
+#endif // PARTICLE_SAMPLER_HPP_
@@ -0,0 +1,173 @@
+#ifndef PERF_COUNTER_HPP_
+#define PERF_COUNTER_HPP_
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <omp.h>
+
+// Hardware counters for the per-phase profile (Linux perf_event_open).
+//
+// Every OpenMP thread opens its own set of user-space counters, so a sample is the
+// sum over the team that exists when open() is called; threads created later (a
+// larger omp_set_num_threads(), the TBB workers of the k-d tree build) are not
+// counted. Counters the CPU, kernel or VM do not expose are left out individually,
+// and when none can be opened (perf_event_paranoid, containers, no PMU) open()
+// returns false and the profile falls back to timing only.
+namespace perf_counter
+{
+
+enum counter
+{
+    cycles, instructions, l1d_miss, llc_miss,
+    num_counter
+};
+
+const char *const counter_name[num_counter] =
+{
+    "cycles", "instructions", "l1d_miss", "llc_miss"
+};
+
+const unsigned int k_cache_line_bytes = 64;
+
+struct sample
+{
+    uint64_t value[num_counter];
+};
+
+inline perf_event_attr make_attr(counter c)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (c)
+    {
+        case counter::cycles:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case counter::instructions:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case counter::l1d_miss:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        default:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;    // last level cache
+            break;
+    }
+    return attr;
+}
+
+} // namespace perf_counter
+
+
+class PerfCounters
+{
+private:
+    std::vector<int> fd_[perf_counter::num_counter];     // one per OpenMP thread, -1 if unavailable
+    bool available_[perf_counter::num_counter];
+    std::string error_;
+
+public:
+    PerfCounters()
+    : available_{}
+    {
+    };
+
+    // Must be called from the thread that runs the solver, outside parallel regions.
+    bool open()
+    {
+        close();
+        int num_thread = omp_get_max_threads();
+        int first_errno[perf_counter::num_counter] = {};
+        for (int c = 0; c < perf_counter::num_counter; c++) fd_[c].assign(num_thread, -1);
+
+        #pragma omp parallel num_threads(num_thread)
+        {
+            int t = omp_get_thread_num();
+            for (int c = 0; c < perf_counter::num_counter; c++)
+            {
+                perf_event_attr attr = perf_counter::make_attr((perf_counter::counter)c);
+                int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);   // this thread, any CPU
+                fd_[c][t] = fd;
+                if (fd < 0)
+                {
+                    #pragma omp critical
+                    if (first_errno[c] == 0) first_errno[c] = errno;
+                }
+            }
+        }
+
+        bool any = false;
+        for (int c = 0; c < perf_counter::num_counter; c++)
+        {
+            available_[c] = first_errno[c] == 0;
+            if (!available_[c])
+            {
+                for (int &fd : fd_[c]) if (fd >= 0) ::close(fd);
+                fd_[c].clear();
+                error_ = std::string(perf_counter::counter_name[c]) + ": " + std::strerror(first_errno[c]);
+            }
+            any = any || available_[c];
+        }
+        if (!any) close();
+        return any;
+    }
+
+    bool is_open() const
+    {
+        for (int c = 0; c < perf_counter::num_counter; c++) if (available_[c]) return true;
+        return false;
+    }
+    bool is_available(perf_counter::counter c) const { return available_[c]; }
+    // reason for the last counter that failed to open
+    const std::string &get_error() const { return error_; }
+
+    // Running totals summed over the team, scaled up if the kernel multiplexed them.
+    perf_counter::sample read() const
+    {
+        perf_counter::sample s = {};
+        for (int c = 0; c < perf_counter::num_counter; c++)
+        {
+            if (!available_[c]) continue;
+            for (int fd : fd_[c])
+            {
+                uint64_t v[3];   // value, time_enabled, time_running
+                if (::read(fd, v, sizeof(v)) != sizeof(v) || v[2] == 0) continue;
+                s.value[c] += (v[2] < v[1]) ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+            }
+        }
+        return s;
+    }
+
+    void close()
+    {
+        for (int c = 0; c < perf_counter::num_counter; c++)
+        {
+            for (int fd : fd_[c]) if (fd >= 0) ::close(fd);
+            fd_[c].clear();
+            available_[c] = false;
+        }
+    }
+
+    ~PerfCounters() { close(); };
+};
+
+#endif // PERF_COUNTER_HPP_
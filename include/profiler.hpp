@@ -0,0 +1,296 @@
+#ifndef PROFILER_HPP_
+#define PROFILER_HPP_
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <cstdint>
+
+#include "perf_counter.hpp"
+
+// Per-phase wall time of Solver::compute_next_state().
+// Phases are timed with a steady clock on the calling thread (around the OpenMP
+// regions, not inside them), accumulated per step and kept per step so that
+// min / mean / p99 can be reported at the end of a run.
+namespace profiler
+{
+
+enum phase
+{
+    neighborhood, predict, density, pressure,
+    force_pressure, force_diffusion, force_gravity, force_surface_tension,
+    integrate, collision, commit, flow, rigid,
+    num_phase
+};
+
+const char *const phase_name[num_phase] =
+{
+    "neighborhood", "predict", "density", "pressure",
+    "force_pressure", "force_diffusion", "force_gravity", "force_surface_tension",
+    "integrate", "collision", "commit", "flow", "rigid"
+};
+
+struct summary
+{
+    double min;     // sec
+    double mean;
+    double p99;
+    double max;
+};
+
+} // namespace profiler
+
+
+class PhaseProfiler
+{
+private:
+    bool enabled_;
+    double current_[profiler::num_phase];
+    std::vector<float> samples_[profiler::num_phase];   // sec, one entry per step
+    std::vector<float> step_samples_;
+
+    // hardware counters, totals over all steps since enable_counters()
+    std::unique_ptr<PerfCounters> counters_;
+    uint64_t counter_particle_steps_;                   // active particles summed over the counted steps
+    uint64_t counter_total_[profiler::num_phase][perf_counter::num_counter];
+    double counter_time_[profiler::num_phase];          // sec, time of the counted phases
+    unsigned long counter_num_step_;
+
+public:
+    PhaseProfiler()
+    : enabled_(true)
+    , current_{}
+    , counter_particle_steps_(0)
+    , counter_total_{}
+    , counter_time_{}
+    , counter_num_step_(0)
+    {
+    };
+
+    void set_enabled(bool enabled) { enabled_ = enabled; }
+    bool is_enabled() const { return enabled_; }
+
+    inline void add(profiler::phase p, double seconds) { current_[p] += seconds; }
+
+    // Opens the hardware counters; on failure prints why and keeps profiling time only.
+    // The per-particle figures are normalized by the active count passed to end_step().
+    bool enable_counters()
+    {
+        counters_.reset(new PerfCounters());
+        if (!counters_->open())
+        {
+            std::cout << "Hardware counters unavailable (" << counters_->get_error() << "), profiling time only" << std::endl;
+            counters_.reset();
+            return false;
+        }
+        for (int c = 0; c < perf_counter::num_counter; c++)
+        {
+            if (!counters_->is_available((perf_counter::counter)c))
+            {
+                std::cout << "Hardware counter " << perf_counter::counter_name[c] << " unavailable" << std::endl;
+            }
+        }
+        return true;
+    }
+
+    // NULL unless enable_counters() succeeded and profiling is enabled
+    const PerfCounters *get_counters() const { return enabled_ ? counters_.get() : NULL; }
+
+    inline void add_counters(profiler::phase p, const perf_counter::sample &begin, const perf_counter::sample &end, double seconds)
+    {
+        for (int c = 0; c < perf_counter::num_counter; c++) counter_total_[p][c] += end.value[c] - begin.value[c];
+        counter_time_[p] += seconds;
+    }
+
+    // num_particle: active particles during the step
+    void end_step(unsigned int num_particle)
+    {
+        if (!enabled_) return;
+        if (counters_)
+        {
+            counter_num_step_++;
+            counter_particle_steps_ += num_particle;
+        }
+        double step = 0.0;
+        for (int p = 0; p < profiler::num_phase; p++)
+        {
+            samples_[p].push_back(current_[p]);
+            step += current_[p];
+            current_[p] = 0.0;
+        }
+        step_samples_.push_back(step);
+    }
+
+    size_t get_num_step() const { return step_samples_.size(); }
+
+    profiler::summary get_summary(profiler::phase p) const { return summarize(samples_[p]); }
+    profiler::summary get_step_summary() const { return summarize(step_samples_); }
+
+    // mean ms per phase over the last `window` steps, e.g. for an on-screen readout
+    std::string format_recent(size_t window) const
+    {
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(2);
+        size_t n = step_samples_.size();
+        if (n == 0) return "";
+        size_t begin = n > window ? n - window : 0;
+        auto mean = [&](const std::vector<float> &v) {
+            double s = 0.0;
+            for (size_t i = begin; i < n; i++) s += v[i];
+            return 1e3 * s / (n - begin);
+        };
+        os << "step " << mean(step_samples_) << " ms";
+        for (int p = 0; p < profiler::num_phase; p++)
+        {
+            os << " | " << profiler::phase_name[p] << " " << mean(samples_[p]);
+        }
+        return os.str();
+    }
+
+    // Per phase: cycles, instructions, L1D and LLC misses per particle per step, IPC and the
+    // DRAM traffic implied by LLC misses. Empty without counters.
+    std::string format_counters() const
+    {
+        if (!counters_ || counter_num_step_ == 0 || counter_particle_steps_ == 0) return "";
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(1);
+        for (int p = 0; p < profiler::num_phase; p++)
+        {
+            const double per_particle = 1.0 / (double)counter_particle_steps_;
+            const uint64_t *v = counter_total_[p];
+            os << "  " << std::left << std::setw(22) << profiler::phase_name[p] << std::right;
+            if (counters_->is_available(perf_counter::cycles)) os << "  cycles/particle " << std::setw(8) << v[perf_counter::cycles] * per_particle;
+            if (counters_->is_available(perf_counter::instructions)) os << "  instr/particle " << std::setw(8) << v[perf_counter::instructions] * per_particle;
+            if (counters_->is_available(perf_counter::cycles) && counters_->is_available(perf_counter::instructions))
+            {
+                os << "  IPC " << std::setprecision(2) << (v[perf_counter::cycles] ? (double)v[perf_counter::instructions] / v[perf_counter::cycles] : 0.0) << std::setprecision(1);
+            }
+            if (counters_->is_available(perf_counter::l1d_miss)) os << "  L1D miss/particle " << std::setw(7) << v[perf_counter::l1d_miss] * per_particle;
+            if (counters_->is_available(perf_counter::llc_miss))
+            {
+                os << "  LLC miss/particle " << std::setw(6) << v[perf_counter::llc_miss] * per_particle;
+                os << "  LLC traffic " << (counter_time_[p] > 0.0 ? v[perf_counter::llc_miss] * perf_counter::k_cache_line_bytes / counter_time_[p] * 1e-9 : 0.0) << " GB/s";
+            }
+            os << "\n";
+        }
+        return os.str();
+    }
+
+    // one row per step, seconds
+    bool write_csv(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file.is_open())
+        {
+            std::cout << "Failed to open profile file: " << path << std::endl;
+            return false;
+        }
+        file << "step";
+        for (int p = 0; p < profiler::num_phase; p++) file << "," << profiler::phase_name[p];
+        file << ",total\n";
+        for (size_t s = 0; s < step_samples_.size(); s++)
+        {
+            file << s;
+            for (int p = 0; p < profiler::num_phase; p++) file << "," << samples_[p][s];
+            file << "," << step_samples_[s] << "\n";
+        }
+        return true;
+    }
+
+    // min / mean / p99 / max per phase, seconds
+    bool write_json(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file.is_open())
+        {
+            std::cout << "Failed to open profile file: " << path << std::endl;
+            return false;
+        }
+        auto entry = [&](const char *name, const profiler::summary &s) {
+            file << "    \"" << name << "\": {\"min\": " << s.min << ", \"mean\": " << s.mean
+                 << ", \"p99\": " << s.p99 << ", \"max\": " << s.max << "}";
+        };
+        file << "{\n  \"num_step\": " << step_samples_.size() << ",\n  \"phases\": {\n";
+        for (int p = 0; p < profiler::num_phase; p++)
+        {
+            entry(profiler::phase_name[p], get_summary((profiler::phase)p));
+            file << ",\n";
+        }
+        entry("total", get_step_summary());
+        file << "\n  }";
+        if (counters_ && counter_num_step_ > 0)
+        {
+            // totals over all counted steps; absent counters are omitted
+            file << ",\n  \"counters\": {\n    \"num_step\": " << counter_num_step_ << ", \"particle_steps\": " << counter_particle_steps_;
+            for (int p = 0; p < profiler::num_phase; p++)
+            {
+                file << ",\n    \"" << profiler::phase_name[p] << "\": {\"seconds\": " << counter_time_[p];
+                for (int c = 0; c < perf_counter::num_counter; c++)
+                {
+                    if (counters_->is_available((perf_counter::counter)c))
+                    {
+                        file << ", \"" << perf_counter::counter_name[c] << "\": " << counter_total_[p][c];
+                    }
+                }
+                file << "}";
+            }
+            file << "\n  }";
+        }
+        file << "\n}\n";
+        return true;
+    }
+
+    ~PhaseProfiler() {};
+
+private:
+    static profiler::summary summarize(std::vector<float> v)
+    {
+        profiler::summary s = {0.0, 0.0, 0.0, 0.0};
+        if (v.empty()) return s;
+        std::sort(v.begin(), v.end());
+        double sum = 0.0;
+        for (float x : v) sum += x;
+        s.min = v.front();
+        s.max = v.back();
+        s.mean = sum / v.size();
+        s.p99 = v[std::min(v.size() - 1, (size_t)(0.99 * v.size()))];
+        return s;
+    }
+};
+
+// Adds the lifetime of the scope to one phase of a PhaseProfiler, and the counter
+// deltas if counters are enabled. Counters are read outside the timed interval.
+class ScopedPhaseTimer
+{
+private:
+    PhaseProfiler &profiler_;
+    profiler::phase phase_;
+    std::chrono::steady_clock::time_point begin_;
+    perf_counter::sample counter_begin_;
+
+public:
+    ScopedPhaseTimer(PhaseProfiler &profiler, profiler::phase phase)
+    : profiler_(profiler)
+    , phase_(phase)
+    {
+        if (!profiler_.is_enabled()) return;
+        if (const PerfCounters *counters = profiler_.get_counters()) counter_begin_ = counters->read();
+        begin_ = std::chrono::steady_clock::now();
+    };
+
+    ~ScopedPhaseTimer()
+    {
+        if (!profiler_.is_enabled()) return;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_).count();
+        profiler_.add(phase_, seconds);
+        if (const PerfCounters *counters = profiler_.get_counters()) profiler_.add_counters(phase_, counter_begin_, counters->read(), seconds);
+    };
+};
+
+#endif // PROFILER_HPP_
@@ -2,49 +2,96 @@
 #define RAND_GENERATOR_H_
 
 #include <vector>
-#include <cstdlib>
-#include <ctime>
+#include <cstdint>
+#include <cmath>
+#include <random>
 
 #include <glm/glm.hpp>
 
 #include "common.hpp"
- 
-const unsigned int rand_vec_len = 9973;
 
+// Counter-based generator: every sample is a pure function of (seed, index, stream),
+// hashed with the SplitMix64 finalizer, so parallel loops can draw sample i for
+// particle i without shared state and get the same numbers at any thread count.
+//
+// The *_at() functions are the stateless interface. The plain generate_*() functions
+// draw from a private counter for serial code; they are not thread-safe.
 class RandGenerator
 {
 private:
-    std::vector<float> random_num_vec_;
-    unsigned int offset_;
+    uint64_t seed_;
+    uint64_t counter_;      // next index of the sequential stream
+
+    static const uint32_t k_sequential_stream = 0xffffffffu;
 
-private:
-    inline unsigned int get_offset() 
-    {
-        if(++offset_ == rand_vec_len) {
-            offset_ = 0;
-        }
-        return offset_;
-    }
-    
 public:
-    RandGenerator() 
+    RandGenerator()
+    : seed_(k_seed != 0 ? k_seed : ((uint64_t)std::random_device{}() << 32 | std::random_device{}()))
+    , counter_(0)
     {
-        offset_ = 0;
-        random_num_vec_.clear();
-        srand(time(NULL));
-        for(int i = 0; i < rand_vec_len; i++) {
-            random_num_vec_.push_back(static_cast<float> (rand() / static_cast<float> (RAND_MAX)));
-        }
     };
 
+    static inline uint64_t mix(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // 64 random bits for (seed, index, stream)
+    inline uint64_t bits_at(uint64_t index, uint32_t stream) const
+    {
+        return mix(mix(seed_ + 0x9e3779b97f4a7c15ull * (index + 1)) ^ (0xd6e8feb86659fd93ull * ((uint64_t)stream + 1)));
+    }
+
+    // [0, 1) with 24 bits of precision
+    inline float uniform_at(uint64_t index, uint32_t stream) const
+    {
+        return (bits_at(index, stream) >> 40) * (1.0f / 16777216.0f);
+    }
+
+    inline float generate_uniform_at(uint64_t index, float u_min, float u_max, uint32_t stream = 0) const
+    {
+        return u_min + (u_max - u_min) * uniform_at(index, stream);
+    }
+
+    // Box-Muller on two independent uniforms taken from one 64-bit draw
+    inline float generate_gaussian_at(uint64_t index, float std_deviation, float mean, uint32_t stream = 0) const
+    {
+        uint64_t b = bits_at(index, stream);
+        float u1 = ((b >> 40) + 1) * (1.0f / 16777216.0f);     // (0, 1]
+        float u2 = ((b >> 8) & 0xffffff) * (1.0f / 16777216.0f);
+        return mean + std_deviation * std::sqrt(-2.0f * std::log(u1)) * std::cos(2.0f * (float)M_PI * u2);
+    }
+
+    // the three axes use streams 3 * stream + {0, 1, 2}
+    glm::vec3 generate_random_uniform_vec3_at(uint64_t index, float u_min, float u_max, uint32_t stream = 0) const
+    {
+        return {
+            generate_uniform_at(index, u_min, u_max, 3 * stream),
+            generate_uniform_at(index, u_min, u_max, 3 * stream + 1),
+            generate_uniform_at(index, u_min, u_max, 3 * stream + 2)
+        };
+    }
+
+    glm::vec3 generate_random_gaussian_vec3_at(uint64_t index, float std_deviation, float mean, uint32_t stream = 0) const
+    {
+        return {
+            generate_gaussian_at(index, std_deviation, mean, 3 * stream),
+            generate_gaussian_at(index, std_deviation, mean, 3 * stream + 1),
+            generate_gaussian_at(index, std_deviation, mean, 3 * stream + 2)
+        };
+    }
+
+    // Sequential interface ------------------------------------------------------//
     inline float generate_uniform(float u_min, float u_max)
     {
-        return u_min + ((u_max - u_min) * random_num_vec_.at(get_offset()));
+        return generate_uniform_at(counter_++, u_min, u_max, k_sequential_stream);
     }
 
-    inline float generate_gaussian(float std_deviation, float mean) 
+    inline float generate_gaussian(float std_deviation, float mean)
     {
-        return mean + std_deviation * random_num_vec_.at(get_offset());
+        return generate_gaussian_at(counter_++, std_deviation, mean, k_sequential_stream);
     }
 
     glm::vec3 generate_random_uniform_vec3(float u_min, float u_max)
@@ -56,7 +103,7 @@ public:
         };
     }
 
-    glm::vec3 generate_random_gaussian_vec3(float std_deviation, float mean) 
+    glm::vec3 generate_random_gaussian_vec3(float std_deviation, float mean)
     {
         return {
             generate_gaussian(std_deviation, mean),
@@ -65,7 +112,7 @@ public:
         };
     }
 
-    glm::vec3 generate_random_direction_vec(int scalar = 1) 
+    glm::vec3 generate_random_direction_vec(int scalar = 1)
     {
         float theta  = generate_uniform(-M_PI, M_PI);
         float y      = generate_uniform(-1, 1);
@@ -77,8 +124,17 @@ public:
         };
     }
 
+    // Checkpoint access ---------------------------------------------------------//
+    uint64_t get_seed() const { return seed_; }
+    uint64_t get_counter() const { return counter_; }
+    void restore(uint64_t seed, uint64_t counter)
+    {
+        seed_ = seed;
+        counter_ = counter;
+    }
+
     ~RandGenerator() {};
 };
 
 
-#endif // RAND_GENERATOR_H_
\ No newline at end of file
+#endif // RAND_GENERATOR_H_
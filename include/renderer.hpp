@@ -3,6 +3,13 @@
 
 #include <iostream>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <memory>
 #include <unistd.h>
 
 #include <glad/glad.h>  
@@ -15,8 +22,14 @@
 #include "common.hpp"
 #include "timer.hpp"
 #include "solver.hpp"
+#include "triple_buffer.hpp"
+#include "trajectory.hpp"
+#include "particle_culler.hpp"
 #include "OGL/shader.hpp"
 #include "OGL/gl_object.hpp"
+#include "OGL/particle_stream.hpp"
+#include "OGL/offscreen_context.hpp"
+#include "OGL/frame_capture.hpp"
 
 
 int default_src_width  = 3200;
@@ -34,6 +47,23 @@ float camX = camradius;
 float camY = 2.5;
 float camZ = 1.5;
 
+// One displayed frame, published by the simulation thread: the sprites ParticleCuller
+// kept out of the active fluid particles and the boundary particles of the rigid bodies,
+// with their radius scales. The per-instance colors only differ between particles with
+// several materials or rigid bodies, so color is filled only then (Renderer::stream_color).
+// With a persistently mapped position stream, the positions are written straight into
+// the ring slot backing this buffer; otherwise into position_storage, copied over by the
+// render thread.
+struct particle_frame
+{
+    glm::vec3 *position = NULL;
+    unsigned int num_position = 0;
+    int stream_slot = -1;               // -1: not in the stream
+    std::vector<glm::vec3> position_storage;
+    std::vector<glm::vec3> color;
+    std::vector<float> scale;
+};
+
 // Allow window resizing
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
 	glViewport(0, 0, width, height);
@@ -83,8 +113,6 @@ private:
     GLFWwindow* window;
 
     GLuint shaderProgram;
-    GLuint fragmentShader;
-    GLuint vertexShader;
 
     GLuint modelLoc;
     GLuint viewLoc;
@@ -98,62 +126,168 @@ private:
     GLuint box_vertex_buffer;
 
     GLuint particle_vao;
-    GLuint particle_vertex_buffer[2];
-
-    glm::mat4* modelMatrices;
+    GLuint particle_color_buffer;       // per-instance color
+    GLuint particle_scale_buffer;       // per-instance sprite radius scale
+    ParticleStreamBuffer particle_position_stream;
+
+    // Screen-space fluid: sprite depth -> bilateral smoothing -> shading over the box.
+    // Targets are reallocated when the framebuffer size changes.
+    static const int k_num_smoothing_iteration = 2;     // each one horizontal + vertical
+    GLuint sprite_depth_program;
+    GLuint sprite_thickness_program;
+    GLuint bilateral_program;
+    GLuint composite_program;
+    GLuint screen_vao;
+    GLuint fluid_fbo[4];                // sprite depth + color, smoothing into 1, thickness, smoothing into 0
+    GLuint fluid_texture[4];            // eye-space z (0: none), eye-space z, thickness, nearest particle color
+    GLuint fluid_depth_buffer;          // depth test of the sprite depth pass
+    int fluid_width = 0;
+    int fluid_height = 0;
+
+    unsigned int num_instance;
+    bool stream_color = false;
+
+    // frustum culling and level of detail; the simulation thread (the render thread when
+    // replaying) selects the sprites for the camera of the last drawn frame
+    ParticleCuller culler;
+    std::vector<glm::vec3> all_position;
+    std::vector<glm::vec3> all_color;
+    std::vector<float> replay_scale;
 
     Timer timer;
-    Solver sovler;
+    std::unique_ptr<Solver> sovler;     // not constructed when replaying
+    TrajectoryReader replay;
+
+    // written by the simulation thread, consumed by the render thread
+    TripleBuffer<particle_frame> particle_snapshot;
+    std::atomic<bool> simulation_running;
+    // while capturing, the simulation thread sleeps here until its last snapshot is taken
+    std::mutex snapshot_taken_mutex;
+    std::condition_variable snapshot_taken;
+
+    // per-phase solver timings: written to <profile_prefix>.csv/.json on exit and,
+    // if show_profile_overlay, shown in the window title while running
+    std::string profile_prefix;
+    bool show_profile_overlay = false;
+    std::mutex profile_overlay_mutex;
+    std::string profile_overlay;
+
+    // Without a window (offscreen) the context comes from EGL and frames are drawn into
+    // offscreen_fbo. With capture open every drawn frame is written to an image file,
+    // and the simulation thread holds each display frame until it has been drawn.
+    bool offscreen = false;
+    OffscreenContext offscreen_context;
+    GLuint offscreen_fbo = 0;           // 0 (default framebuffer) with a window
+    GLuint offscreen_buffer[2];         // color, depth
+    std::string capture_pattern;
+    FrameCapture capture;
 
 public:
     Renderer();
     ~Renderer();
 
-    void initialize()
+    void set_profiling(const std::string &prefix, bool overlay)
+    {
+        profile_prefix = prefix;
+        show_profile_overlay = overlay;
+    }
+
+    // min_sprite_pixel: far particles are thinned out until their sprites are this many
+    // pixels across (0: never); budget: most sprites per frame (0: no limit)
+    void set_level_of_detail(float min_sprite_pixel, unsigned int budget)
+    {
+        culler.set_level_of_detail(min_sprite_pixel, budget);
+    }
+
+    // pattern: printf pattern of the .png / .ppm files, e.g. frame_%05d.png (empty: none)
+    void set_capture(const std::string &pattern, bool no_window)
+    {
+        capture_pattern = pattern;
+        offscreen = no_window;
+    }
+
+    // replay_path: play back a trajectory file instead of running the solver
+    bool initialize(const std::string &replay_path = "")
     {
         timer.reset(refresh_interval);
-        modelMatrices =  new glm::mat4[k_num_particle];
-      
-        glfwInit();
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-        window = glfwCreateWindow(default_src_width, default_src_height, k_project_name, NULL, NULL);
-        if (window == NULL) {
-            std::cout << "Failed to create GLFW window" << std::endl;
-            glfwTerminate();
-            return;
+        if (replay_path.empty())
+        {
+            sovler.reset(new Solver());
+            num_instance = k_num_particle_capacity + sovler->get_rigid_bodies().get_boundary_positions().size();
+            stream_color = k_multi_material || sovler->get_rigid_bodies().is_enabled();
+            particle_snapshot.for_each_buffer([this](particle_frame &b) {
+                b.scale.reserve(num_instance);
+                if (stream_color) b.color.reserve(num_instance);
+            });
         }
-        glfwMakeContextCurrent(window);
-    
-        // GLAD manages function pointers for OpenGL, so we want to initialize GLAD before we call any OpenGL function
-        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-            std::cout << "Failed to initialize GLAD" << std::endl;
-            return;
+        else
+        {
+            if (!replay.open(replay_path)) return false;
+            if (replay.get_num_frame() == 0)
+            {
+                std::cout << "Trajectory has no complete frame: " << replay_path << std::endl;
+                return false;
+            }
+            if (replay.get_world_edge_size() != k_world_edge_size)
+            {
+                std::cout << "Trajectory was recorded with world_edge_size=" << replay.get_world_edge_size() << std::endl;
+                return false;
+            }
+            num_instance = 0;
+            for (unsigned int f = 0; f < replay.get_num_frame(); f++)
+            {
+                num_instance = std::max(num_instance, replay.get_num_particle(f));
+            }
+        }
+
+        if (offscreen)
+        {
+            window = NULL;
+            if (!offscreen_context.create(3, 3)) return false;
+            if (!gladLoadGLLoader((GLADloadproc)OffscreenContext::get_proc_address)) {
+                std::cout << "Failed to initialize GLAD" << std::endl;
+                return false;
+            }
+            if (!check_frame_size() || !create_offscreen_framebuffer(default_src_width, default_src_height)) return false;
+        }
+        else
+        {
+            glfwInit();
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+            window = glfwCreateWindow(default_src_width, default_src_height, k_project_name, NULL, NULL);
+            if (window == NULL) {
+                std::cout << "Failed to create GLFW window" << std::endl;
+                glfwTerminate();
+                return false;
+            }
+            glfwMakeContextCurrent(window);
+            // captured frames must not wait for the display's vertical sync
+            glfwSwapInterval(capture_pattern.empty() ? 1 : 0);
+
+            // GLAD manages function pointers for OpenGL, so we want to initialize GLAD before we call any OpenGL function
+            if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+                std::cout << "Failed to initialize GLAD" << std::endl;
+                return false;
+            }
+            if (!check_frame_size()) return false;
+            glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
         }
         glViewport(0, 0, default_src_width, default_src_height);
-        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        if (!capture_pattern.empty() && !capture.open(capture_pattern)) return false;
 
         // Enable depth buffering, backface culling
         glEnable(GL_DEPTH_TEST);
         // glEnable(GL_CULL_FACE);
         // glCullFace(GL_BACK);
 
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-        glCompileShader(vertexShader);
-
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-        glCompileShader(fragmentShader);
-
-        shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vertexShader);
-        glAttachShader(shaderProgram, fragmentShader);
-        glLinkProgram(shaderProgram);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+        shaderProgram = build_program(vertexShaderSource, fragmentShaderSource);
+        sprite_depth_program = build_program(spriteVertexShaderSource, spriteDepthFragmentShaderSource);
+        sprite_thickness_program = build_program(spriteVertexShaderSource, spriteThicknessFragmentShaderSource);
+        bilateral_program = build_program(screenVertexShaderSource, bilateralFragmentShaderSource);
+        composite_program = build_program(screenVertexShaderSource, compositeFragmentShaderSource);
         glUseProgram(shaderProgram);
 
         // box
@@ -168,20 +302,51 @@ public:
             glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
             glEnableVertexAttribArray(1);
         
-        // particle
+        // particle: one point sprite per instance
         glGenVertexArrays(1, &particle_vao);
-        glGenBuffers(2, particle_vertex_buffer);
+        glGenBuffers(1, &particle_color_buffer);
+        glGenBuffers(1, &particle_scale_buffer);
 
         glBindVertexArray(particle_vao);
-            glBindBuffer(GL_ARRAY_BUFFER, particle_vertex_buffer[0]);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(GLObj::particle), GLObj::particle, GL_STATIC_DRAW);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-            glEnableVertexAttribArray(0);
-
-            glBindBuffer(GL_ARRAY_BUFFER, particle_vertex_buffer[1]);
-            glBufferData(GL_ARRAY_BUFFER, sovler.get_gl_particle_color().size() * sizeof(glm::vec3), glm::value_ptr(sovler.get_gl_particle_color()[0]), GL_STATIC_DRAW);
+            std::vector<glm::vec3> particle_color(num_instance, k_particle_color);
+            if (sovler)
+            {
+                particle_color = sovler->get_gl_particle_color();
+                particle_color.resize(num_instance, k_rigid_body_color);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, particle_color_buffer);
+            glBufferData(GL_ARRAY_BUFFER, particle_color.size() * sizeof(glm::vec3), glm::value_ptr(particle_color[0]), stream_color ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
             glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
             glEnableVertexAttribArray(1);
+            glVertexAttribDivisor(1, 1);
+
+            std::vector<float> particle_scale(num_instance, 1.0f);
+            glBindBuffer(GL_ARRAY_BUFFER, particle_scale_buffer);
+            glBufferData(GL_ARRAY_BUFFER, particle_scale.size() * sizeof(float), particle_scale.data(), GL_STREAM_DRAW);
+            glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
+            glEnableVertexAttribArray(3);
+            glVertexAttribDivisor(3, 1);
+
+            particle_position_stream.initialize(2, num_instance);
+            if (sovler)
+            {
+                // buffer i of the snapshot is ring slot i
+                static_assert(k_num_stream_slot == 3, "one stream slot per triple buffer slot");
+                const bool direct = particle_position_stream.is_persistent();
+                int slot = 0;
+                particle_snapshot.for_each_buffer([&](particle_frame &b) {
+                    if (!direct) b.position_storage.resize(num_instance);
+                    b.stream_slot = direct ? slot : -1;
+                    b.position = direct ? particle_position_stream.get_slot(slot) : b.position_storage.data();
+                    slot++;
+                });
+            }
+
+        // screen-space fluid; the full-screen passes have no vertex attributes
+        glGenVertexArrays(1, &screen_vao);
+        glGenFramebuffers(4, fluid_fbo);
+        glGenTextures(4, fluid_texture);
+        glGenRenderbuffers(1, &fluid_depth_buffer);
 
         // Declare model/view/projection matrices
         model = glm::mat4(1.0f);
@@ -194,30 +359,207 @@ public:
         // Set Projection matrix
         projection = glm::perspective(glm::radians(45.0f), 1.0f*default_src_width/default_src_height, 0.1f, 100.0f);
         glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        return true;
     }
 
     void start_looping()
     {
-        while(!glfwWindowShouldClose(window) && !timer.is_time_to_stop())
+        if (!sovler)
+        {
+            replay_looping();
+            return;
+        }
+
+        simulation_running.store(true);
+        std::thread simulation_thread(&Renderer::simulate, this);
+        auto overlay_time = std::chrono::steady_clock::now();
+
+        // the last frame published before the simulation stops is still drawn
+        while(!is_closing() && (simulation_running.load(std::memory_order_acquire) || particle_snapshot.is_pending()))
         {
             // processInput(window);
-            glfwPollEvents();
+            if (particle_snapshot.is_pending()) release_drawn_slot();
+            if (particle_snapshot.update()) 
+            {
+                if (capture.is_open()) notify_snapshot_taken();
+                if (window) glfwPollEvents();
+                update_particle_position();
+                draw();
+
+                auto now = std::chrono::steady_clock::now();
+                if (window && show_profile_overlay && now - overlay_time > std::chrono::milliseconds(500))
+                {
+                    overlay_time = now;
+                    std::lock_guard<std::mutex> lock(profile_overlay_mutex);
+                    glfwSetWindowTitle(window, (std::string(k_project_name) + " | " + profile_overlay).c_str());
+                }
+            }
+            else if (window)
+            {
+                glfwWaitEventsTimeout(0.001);
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        simulation_running.store(false, std::memory_order_release);
+        notify_snapshot_taken();
+        simulation_thread.join();
+        if (!profile_prefix.empty())
+        {
+            sovler->get_profiler().write_csv(profile_prefix + ".csv");
+            sovler->get_profiler().write_json(profile_prefix + ".json");
+        }
+        terminate();
+    }
 
+    // Runs on its own thread; never touches GL.
+    void simulate()
+    {
+        while(simulation_running.load(std::memory_order_acquire) && !timer.is_time_to_stop())
+        {
             if (timer.is_time_to_draw()) 
             {
+                if (capture.is_open())
+                {
+                    std::unique_lock<std::mutex> lock(snapshot_taken_mutex);
+                    snapshot_taken.wait(lock, [this] {
+                        return !particle_snapshot.is_pending() || !simulation_running.load(std::memory_order_acquire);
+                    });
+                }
                 timer.update_next_display_time();
-                update_particle_position();
-                draw();
+                particle_frame &snapshot = particle_snapshot.get_write_buffer();
+                const unsigned int n = sovler->get_particles().get_num_active();
+                const std::vector<glm::vec3> &boundary = sovler->get_rigid_bodies().get_boundary_positions();
+                all_position.resize(n + boundary.size());
+                sovler->write_gl_particle_position(all_position.data());
+                for (unsigned int b = 0; b < boundary.size(); b++)
+                {
+                    glm::vec3 p = boundary[b];
+                    all_position[n + b] = transform_world2gl(p);
+                }
+                if (stream_color)
+                {
+                    const std::vector<glm::vec3> &color = sovler->get_gl_particle_color();
+                    all_color.assign(color.begin(), color.begin() + n);
+                    all_color.resize(n + boundary.size(), k_rigid_body_color);
+                }
+                // within the reserved capacity
+                snapshot.num_position = culler.select(all_position.data(), stream_color ? all_color.data() : NULL, all_position.size(),
+                                                      snapshot.position, stream_color ? &snapshot.color : NULL, snapshot.scale);
+                particle_snapshot.publish();
+
+                if (show_profile_overlay)
+                {
+                    std::string text = sovler->get_profiler().format_recent(30);
+                    std::lock_guard<std::mutex> lock(profile_overlay_mutex);
+                    profile_overlay.swap(text);
+                }
             }
-            sovler.compute_next_state();
+            sovler->compute_next_state();
             timer.update_simulation_time();
         }
-        delete_GLBuffers();
-        glfwTerminate();
+        simulation_running.store(false, std::memory_order_release);
+    }
+
+    // One trajectory frame per displayed frame, looping; SPACE pauses, LEFT / RIGHT scrub.
+    // Offscreen, every frame is drawn once.
+    void replay_looping()
+    {
+        unsigned int frame = 0;
+        bool paused = false;
+        bool space_down = false;
+        const unsigned int num_frame = replay.get_num_frame();
+
+        if (!window)
+        {
+            for (frame = 0; frame < num_frame; frame++) draw_replay_frame(frame);
+            terminate();
+            return;
+        }
+
+        while(!glfwWindowShouldClose(window))
+        {
+            glfwPollEvents();
+
+            bool space = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+            if (space && !space_down) paused = !paused;
+            space_down = space;
+            if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) frame = (frame + 1) % num_frame;
+            else if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) frame = (frame + num_frame - 1) % num_frame;
+            else if (!paused) frame = (frame + 1) % num_frame;
+
+            draw_replay_frame(frame);
+        }
+        terminate();
     }
 
-    void draw() 
+    void draw_replay_frame(unsigned int frame)
     {
+        all_position.resize(replay.get_num_particle(frame));
+        replay.write_gl_particle_position(frame, all_position.data());
+        const unsigned int m = culler.select(all_position.data(), NULL, all_position.size(),
+                                             particle_position_stream.begin_write(), NULL, replay_scale);
+        particle_position_stream.end_write();
+        upload_particle_attributes(NULL, replay_scale);
+        draw(m);
+    }
+
+    void draw() { draw(num_instance); }
+
+    void draw(unsigned int num_particle) 
+    {
+        int width = default_src_width, height = default_src_height;
+        if (window) glfwGetFramebufferSize(window, &width, &height);
+        resize_fluid_targets(width, height);
+        const float point_scale = height * projection[1][1];
+        const float radius = GLObj::particle_radius();
+
+        // Set view matrix
+        view = glm::lookAt(glm::vec3(camX, camY, camZ), glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 0.0, 2.0));
+        culler.set_camera({projection * view, glm::vec3(camX, camY, camZ), point_scale, radius});
+
+        // nearest sphere surface per pixel
+        glBindFramebuffer(GL_FRAMEBUFFER, fluid_fbo[0]);
+        glViewport(0, 0, width, height);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        use_sprite_program(sprite_depth_program, point_scale, radius);
+        glBindVertexArray(particle_vao);
+            particle_position_stream.draw(GL_POINTS, 1, num_particle);
+
+        // thickness along the view ray, every sphere counts
+        glBindFramebuffer(GL_FRAMEBUFFER, fluid_fbo[2]);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        use_sprite_program(sprite_thickness_program, point_scale, radius);
+            particle_position_stream.draw(GL_POINTS, 1, num_particle);
+        glDisable(GL_BLEND);
+
+        // bilateral smoothing, ping-pong between the two depth maps; ends in fluid_texture[0]
+        glUseProgram(bilateral_program);
+        glUniform1i(glGetUniformLocation(bilateral_program, "depthMap"), 0);
+        glUniform1f(glGetUniformLocation(bilateral_program, "pointScale"), point_scale);
+        glUniform1f(glGetUniformLocation(bilateral_program, "radius"), radius);
+        glActiveTexture(GL_TEXTURE0);
+        glBindVertexArray(screen_vao);
+        for (int pass = 0; pass < 2 * k_num_smoothing_iteration; pass++)
+        {
+            const int src = pass % 2;
+            glBindFramebuffer(GL_FRAMEBUFFER, fluid_fbo[src == 0 ? 1 : 3]);
+            glBindTexture(GL_TEXTURE_2D, fluid_texture[src]);
+            glUniform2f(glGetUniformLocation(bilateral_program, "direction"), src == 0 ? 1.0f / width : 0.0f, src == 0 ? 0.0f : 1.0f / height);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, offscreen_fbo);
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         // glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -225,47 +567,229 @@ public:
         glEnable(GL_CULL_FACE);
         glCullFace(GL_BACK);
 
-        // Set view matrix
-        view = glm::lookAt(glm::vec3(camX, camY, camZ), glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 0.0, 2.0));
+        glUseProgram(shaderProgram);
         glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        model = glm::mat4(1.0f);
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
         glBindVertexArray(box_vao);
             model = glm::mat4(1.0f);
             glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
             glDrawArrays(GL_TRIANGLES, 0, 36);
-        
-        glBindVertexArray(particle_vao);
-        #pragma parallel for 
-        for(int i = 0; i < k_num_particle; i++)
+
+        // fluid surface, depth tested against the box
+        glDisable(GL_CULL_FACE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glUseProgram(composite_program);
+        glm::vec4 light = view * glm::vec4(0.3f, 0.5f, 1.0f, 0.0f);
+        glUniform3fv(glGetUniformLocation(composite_program, "lightDir"), 1, glm::value_ptr(glm::normalize(glm::vec3(light.x, light.y, light.z))));
+        glUniform2f(glGetUniformLocation(composite_program, "texel"), 1.0f / width, 1.0f / height);
+        glUniform1f(glGetUniformLocation(composite_program, "absorption"), 4.0f);
+        glUniformMatrix4fv(glGetUniformLocation(composite_program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform1i(glGetUniformLocation(composite_program, "depthMap"), 0);
+        glUniform1i(glGetUniformLocation(composite_program, "thicknessMap"), 1);
+        glUniform1i(glGetUniformLocation(composite_program, "colorMap"), 2);
+        for (int i : {0, 2, 3})
         {
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrices[i]));
-            glDrawArrays(GL_TRIANGLES, 0, 24);
+            glActiveTexture(GL_TEXTURE0 + (i == 0 ? 0 : i - 1));
+            glBindTexture(GL_TEXTURE_2D, fluid_texture[i]);
         }
+        glBindVertexArray(screen_vao);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        glDisable(GL_BLEND);
+        glActiveTexture(GL_TEXTURE0);
 
-        // glDisable(GL_DEPTH_TEST);
-        glfwSwapBuffers(window);
+        if (capture.is_open()) capture.grab(offscreen_fbo, width, height);
+        if (window) glfwSwapBuffers(window);
     }
 
     void update_particle_position()
     {
-        #pragma omp parallel for private(model)
-        for (int i = 0; i < k_num_particle; i++)
+        const particle_frame &snapshot = particle_snapshot.get_read_buffer();
+        if (snapshot.stream_slot >= 0) particle_position_stream.use_slot(snapshot.stream_slot);
+        else
         {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, sovler.get_gl_particle_position()[i]);
-            modelMatrices[i] = model;
+            std::memcpy(particle_position_stream.begin_write(), snapshot.position, snapshot.num_position * sizeof(glm::vec3));
+            particle_position_stream.end_write();
+        }
+        upload_particle_attributes(stream_color ? &snapshot.color : NULL, snapshot.scale);
+        num_instance = snapshot.num_position;
+    }
+
+    void upload_particle_attributes(const std::vector<glm::vec3> *color, const std::vector<float> &scale)
+    {
+        if (color)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, particle_color_buffer);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, color->size() * sizeof(glm::vec3), color->data());
         }
+        glBindBuffer(GL_ARRAY_BUFFER, particle_scale_buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, scale.size() * sizeof(float), scale.data());
     }
 
     void delete_GLBuffers()
     {
         glDeleteVertexArrays(1, &box_vao);
         glDeleteVertexArrays(1, &particle_vao);
-        glDeleteBuffers(2, particle_vertex_buffer);
+        glDeleteBuffers(1, &particle_color_buffer);
+        glDeleteBuffers(1, &particle_scale_buffer);
+        particle_position_stream.release();
         glDeleteBuffers(1, &box_vertex_buffer);
         glDeleteProgram(shaderProgram);
+
+        glDeleteVertexArrays(1, &screen_vao);
+        glDeleteFramebuffers(4, fluid_fbo);
+        glDeleteTextures(4, fluid_texture);
+        glDeleteRenderbuffers(1, &fluid_depth_buffer);
+        for (GLuint program : {sprite_depth_program, sprite_thickness_program, bilateral_program, composite_program})
+            glDeleteProgram(program);
+        if (offscreen_fbo)
+        {
+            glDeleteFramebuffers(1, &offscreen_fbo);
+            glDeleteRenderbuffers(2, offscreen_buffer);
+        }
+    }
+
+    // Writes out the captured frames, then releases GL and the window or EGL context.
+    void terminate()
+    {
+        capture.close();
+        delete_GLBuffers();
+        if (window) glfwTerminate();
+        else offscreen_context.destroy();
+    }
+
+private:
+    bool is_closing() { return window && glfwWindowShouldClose(window); }
+
+    // The read buffer goes back to the simulation thread with the next update(); when it
+    // is a ring slot, the GPU must be done drawing from it first. The draw was issued a
+    // loop iteration ago, so this rarely waits.
+    void release_drawn_slot()
+    {
+        const particle_frame &drawn = particle_snapshot.get_read_buffer();
+        if (drawn.stream_slot >= 0) particle_position_stream.wait_slot(drawn.stream_slot);
+    }
+
+    // Wakes simulate() after a snapshot was taken or the simulation was stopped. The
+    // mutex is taken so the wakeup cannot fall between its check and its wait.
+    void notify_snapshot_taken()
+    {
+        {
+            std::lock_guard<std::mutex> lock(snapshot_taken_mutex);
+        }
+        snapshot_taken.notify_one();
+    }
+
+    // The fluid passes and the offscreen target are renderbuffers of the frame size.
+    bool check_frame_size()
+    {
+        GLint max_size = 0;
+        glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_size);
+        if (default_src_width > max_size || default_src_height > max_size)
+        {
+            std::cout << "Frame size " << default_src_width << "x" << default_src_height << " exceeds GL_MAX_RENDERBUFFER_SIZE " << max_size << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool create_offscreen_framebuffer(int width, int height)
+    {
+        glGenFramebuffers(1, &offscreen_fbo);
+        glGenRenderbuffers(2, offscreen_buffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, offscreen_buffer[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, offscreen_buffer[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, offscreen_fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreen_buffer[0]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, offscreen_buffer[1]);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "Failed to complete offscreen framebuffer" << std::endl;
+            return false;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return true;
+    }
+
+    GLuint build_program(const char *vertex_source, const char *fragment_source)
+    {
+        GLuint shader[2] = {glCreateShader(GL_VERTEX_SHADER), glCreateShader(GL_FRAGMENT_SHADER)};
+        const char *source[2] = {vertex_source, fragment_source};
+        GLuint program = glCreateProgram();
+        char log[1024];
+        GLint ok;
+        for (int i = 0; i < 2; i++)
+        {
+            glShaderSource(shader[i], 1, &source[i], NULL);
+            glCompileShader(shader[i]);
+            glGetShaderiv(shader[i], GL_COMPILE_STATUS, &ok);
+            if (!ok)
+            {
+                glGetShaderInfoLog(shader[i], sizeof(log), NULL, log);
+                std::cout << "Failed to compile shader: " << log << std::endl;
+            }
+            glAttachShader(program, shader[i]);
+        }
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        if (!ok)
+        {
+            glGetProgramInfoLog(program, sizeof(log), NULL, log);
+            std::cout << "Failed to link shader program: " << log << std::endl;
+        }
+        glDeleteShader(shader[0]);
+        glDeleteShader(shader[1]);
+        return program;
+    }
+
+    void use_sprite_program(GLuint program, float point_scale, float radius)
+    {
+        glUseProgram(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform1f(glGetUniformLocation(program, "pointScale"), point_scale);
+        glUniform1f(glGetUniformLocation(program, "radius"), radius);
+    }
+
+    void resize_fluid_targets(int width, int height)
+    {
+        if (width == fluid_width && height == fluid_height) return;
+        fluid_width = width;
+        fluid_height = height;
+
+        const GLint internal_format[4] = {GL_R32F, GL_R32F, GL_R16F, GL_RGBA8};
+        const GLenum format[4] = {GL_RED, GL_RED, GL_RED, GL_RGBA};
+        for (int i = 0; i < 4; i++)
+        {
+            glBindTexture(GL_TEXTURE_2D, fluid_texture[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, internal_format[i], width, height, 0, format[i], i < 3 ? GL_FLOAT : GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);     // never blend depths across a silhouette
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, fluid_fbo[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fluid_texture[i % 3], 0);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, fluid_depth_buffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, fluid_fbo[0]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, fluid_texture[3], 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, fluid_depth_buffer);
+        const GLenum attachment[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, attachment);
+        for (int i = 0; i < 4; i++)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, fluid_fbo[i]);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            {
+                std::cout << "Failed to complete fluid framebuffer " << i << std::endl;
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
 };
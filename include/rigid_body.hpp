@@ -0,0 +1,297 @@
+#ifndef RIGID_BODY_HPP_
+#define RIGID_BODY_HPP_
+
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <omp.h>
+#include <cyCodeBase/cyPointCloud.h>
+
+#include "common.hpp"
+#include "particle.hpp"
+#include "particle_sampler.hpp"
+
+// Rigid bodies from k_rigid_bodies, coupled both ways with the fluid through boundary
+// particles (Akinci et al. 2012). Each body is a one-layer shell of boundary particles
+// fixed in the body frame. Boundary particle b adds rho0_i * psi_b * W_ib to the density
+// of fluid particle i and acts as a mirrored neighbour (density rho_i) in its pressure
+// force; the opposite force, and its torque about the centre of mass, act on the body.
+//
+// psi_b = 1 / sum_k W_bk over the body's own shell never changes, and fluid particles
+// search each body's k-d tree in body coordinates, so the static geometry is built once
+// and only the world positions of the shell are refreshed each step. Bodies collide with
+// the box but not with each other.
+class RigidBodySystem
+{
+public:
+    // Saved verbatim in checkpoints.
+    struct body
+    {
+        glm::vec3 position;         // centre of mass, world
+        glm::vec3 velocity;
+        glm::vec3 angular_velocity; // world
+        glm::mat3 rotation;         // body to world
+        float mass;
+        glm::vec3 inertia;          // principal moments, body frame
+        float bound_radius;         // of the shell around position
+        unsigned int first;         // boundary particles [first, first + count)
+        unsigned int count;
+    };
+
+private:
+    typedef cy::PointCloud<glm::vec3, float, 3> point_cloud;
+
+    std::vector<body> bodies_;
+    std::vector<std::unique_ptr<point_cloud>> local_tree_;
+
+    // boundary particles of every body
+    std::vector<glm::vec3> local_;          // body frame
+    std::vector<glm::vec3> world_;
+    std::vector<float> psi_;
+    std::vector<unsigned int> owner_;
+
+    std::vector<std::vector<unsigned int>> contact_;    // boundary particles near fluid particle i
+    std::vector<glm::vec3> block_sum_;                  // reaction force, torque per [body][block of fluid particles]
+    int num_block_;                                     // blocks in block_sum_ from the last add_force_pressure()
+
+    // reactions are summed in fixed blocks, so the result does not depend on the thread count
+    static const int k_block_size = 1024;
+
+public:
+    RigidBodySystem()
+    : num_block_(0)
+    {
+        // fluid rest spacing, but tight enough that no fluid particle fits between two
+        // boundary particles without seeing one of them
+        const float h = std::min(std::cbrt(k_fluid_volume / k_num_particle), 0.5f * k_sph_s);
+        for (const RigidBodyConfig &c : k_rigid_bodies)
+        {
+            body b;
+            glm::vec3 extent = {c.extent[0], c.extent[1], c.extent[2]};
+            b.position = {c.center[0], c.center[1], c.center[2]};
+            b.velocity = b.angular_velocity = {0.0f, 0.0f, 0.0f};
+            b.rotation = glm::mat3(1.0f);
+
+            particle_sampler::region shape = {-0.5f * extent, 0.5f * extent, c.ellipsoid};
+            b.mass = c.density * shape.volume();
+            glm::vec3 e2 = 0.25f * extent * extent;     // squared half extents
+            float k = c.ellipsoid ? 0.2f : 1.0f / 3.0f;
+            b.inertia = k * b.mass * glm::vec3(e2.y + e2.z, e2.x + e2.z, e2.x + e2.y);
+
+            b.first = local_.size();
+            sample_shell(shape, h);
+            b.count = local_.size() - b.first;
+            b.bound_radius = 0.0f;
+            for (unsigned int i = b.first; i < local_.size(); i++)
+            {
+                b.bound_radius = std::max(b.bound_radius, glm::length(local_[i]));
+                owner_.push_back(bodies_.size());
+            }
+
+            local_tree_.emplace_back(new point_cloud());
+            local_tree_.back()->Build(b.count, &local_[b.first]);
+            bodies_.push_back(b);
+        }
+
+        psi_.assign(local_.size(), 0.0f);
+        for (unsigned int k = 0; k < bodies_.size(); k++)
+        {
+            const body &b = bodies_[k];
+            #pragma omp parallel for
+            for (int i = b.first; i < (int)(b.first + b.count); i++)
+            {
+                float sum = 0.0f;
+                local_tree_[k]->GetPoints(local_[i], k_sph_s, [&](unsigned int, glm::vec3 const &p, float, float &) {
+                    sum += sph_default_kernel(local_[i] - p);
+                });
+                psi_[i] = 1.0f / sum;
+            }
+        }
+        world_.resize(local_.size());
+        update_world_positions();
+    };
+
+    bool is_enabled() const { return !bodies_.empty(); }
+    const std::vector<body> &get_bodies() const { return bodies_; }
+    const std::vector<glm::vec3> &get_boundary_positions() const { return world_; }
+
+    // Visits the body states as (data, bytes), for checkpoints.
+    template <typename F>
+    void for_each_state(F f)
+    {
+        f((void *)bodies_.data(), bodies_.size() * sizeof(body));
+    }
+
+    // Finds the boundary particles within k_sph_s of every fluid particle at next_position.
+    void find_contacts(Particle &particles)
+    {
+        update_world_positions();   // the body states may have been restored from a checkpoint
+        const int n = particles.get_num_active();
+        contact_.resize(particles.get_capacity());
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+        {
+            contact_[i].clear();
+            for (unsigned int k = 0; k < bodies_.size(); k++)
+            {
+                const body &b = bodies_[k];
+                glm::vec3 d = particles.next_position[i] - b.position;
+                if (glm::length(d) > b.bound_radius + k_sph_s) continue;
+                glm::vec3 p = glm::transpose(b.rotation) * d;
+                local_tree_[k]->GetPoints(p, k_sph_s, [&](unsigned int j, glm::vec3 const &, float, float &) {
+                    contact_[i].push_back(b.first + j);
+                });
+            }
+        }
+    }
+
+    template <typename Kernel>
+    void add_density(Particle &particles)
+    {
+        const int n = particles.get_num_active();
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+        {
+            const float rest_density = k_material_table.rest_density[particles.material_id[i]];
+            for (unsigned int b : contact_[i])
+            {
+                particles.density[i] += rest_density * psi_[b] * Kernel::density(particles.next_position[i] - world_[b]);
+            }
+        }
+    }
+
+    // Same form as SphSolver::compute_force_pressure() with the boundary particle standing
+    // in for a neighbour of mass rho0_i * psi_b and density rho_i.
+    template <typename Kernel>
+    void add_force_pressure(Particle &particles)
+    {
+        const int n = particles.get_num_active();
+        const int num_block = (n + k_block_size - 1) / k_block_size;
+        num_block_ = num_block;
+        block_sum_.assign(2 * bodies_.size() * num_block, glm::vec3(0.0f));
+        #pragma omp parallel for schedule(static)
+        for (int blk = 0; blk < num_block; blk++)
+        {
+            for (int i = blk * k_block_size; i < std::min(n, (blk + 1) * k_block_size); i++)
+            {
+                const float rest_density = k_material_table.rest_density[particles.material_id[i]];
+                const float mass = k_material_table.particle_mass[particles.material_id[i]];
+                for (unsigned int b : contact_[i])
+                {
+                    glm::vec3 f = -k_pressure_force_scale * 2.0f * rest_density * psi_[b]
+                        * Kernel::pressure_gradient(particles.next_position[i] - world_[b]);
+                    particles.force[i] += f;
+
+                    const unsigned int k = owner_[b];
+                    glm::vec3 reaction = -mass * f / particles.density[i];      // force density to force
+                    glm::vec3 *sum = &block_sum_[2 * ((size_t)k * num_block + blk)];
+                    sum[0] += reaction;
+                    sum[1] += glm::cross(world_[b] - bodies_[k].position, reaction);
+                }
+            }
+        }
+    }
+
+    // Advances every body by dt under gravity and the reactions from add_force_pressure().
+    void integrate(float dt)
+    {
+        for (unsigned int k = 0; k < bodies_.size(); k++)
+        {
+            glm::vec3 f = bodies_[k].mass * k_gravity_acceleration;
+            glm::vec3 t = {0.0f, 0.0f, 0.0f};
+            for (int blk = 0; blk < num_block_; blk++)
+            {
+                f += block_sum_[2 * ((size_t)k * num_block_ + blk)];
+                t += block_sum_[2 * ((size_t)k * num_block_ + blk) + 1];
+            }
+            advance(bodies_[k], f, t, dt);
+        }
+        update_world_positions();
+
+        for (body &b : bodies_) resolve_wall_collision(b);
+        update_world_positions();
+    }
+
+    ~RigidBodySystem() {};
+
+private:
+    // Boundary particles on a lattice of spacing h, keeping the outermost layer of the shape.
+    void sample_shell(const particle_sampler::region &shape, float h)
+    {
+        particle_sampler::region inner = {shape.lo + h, shape.hi - h, shape.ellipsoid};
+        bool hollow = true;     // thinner than two layers: every lattice point is on the shell
+        int num[3];
+        for (int a = 0; a < 3; a++)
+        {
+            num[a] = std::max(1, (int)std::round((shape.hi[a] - shape.lo[a]) / h)) + 1;
+            hollow = hollow && inner.hi[a] > inner.lo[a];
+        }
+        for (int z = 0; z < num[2]; z++)
+            for (int y = 0; y < num[1]; y++)
+                for (int x = 0; x < num[0]; x++)
+                {
+                    glm::vec3 t = {num[0] > 1 ? (float)x / (num[0] - 1) : 0.5f,
+                                   num[1] > 1 ? (float)y / (num[1] - 1) : 0.5f,
+                                   num[2] > 1 ? (float)z / (num[2] - 1) : 0.5f};
+                    glm::vec3 p = shape.lo + t * (shape.hi - shape.lo);
+                    if (shape.contains(p) && !(hollow && inner.contains(p))) local_.push_back(p);
+                }
+    }
+
+    // Semi-implicit Euler; the angular step uses Euler's equations in the body frame.
+    static void advance(body &b, glm::vec3 force, glm::vec3 torque, float dt)
+    {
+        b.velocity += force / b.mass * dt;
+        b.position += b.velocity * dt;
+
+        glm::mat3 to_body = glm::transpose(b.rotation);
+        glm::vec3 w = to_body * b.angular_velocity;
+        w += (to_body * torque - glm::cross(w, b.inertia * w)) / b.inertia * dt;
+        b.angular_velocity = b.rotation * w;
+
+        glm::vec3 d = b.angular_velocity * dt;
+        glm::mat3 skew = glm::mat3(glm::vec3(0.0f, d.z, -d.y), glm::vec3(-d.z, 0.0f, d.x), glm::vec3(d.y, -d.x, 0.0f));
+        b.rotation = b.rotation + skew * b.rotation;
+
+        // re-orthonormalize (Gram-Schmidt on the columns)
+        glm::vec3 c0 = glm::normalize(b.rotation[0]);
+        glm::vec3 c1 = glm::normalize(b.rotation[1] - glm::dot(b.rotation[1], c0) * c0);
+        b.rotation = glm::mat3(c0, c1, glm::cross(c0, c1));
+    }
+
+    // Pushes the shell back inside the box; the normal velocity is reflected at half
+    // speed like a fluid particle in collision::detect_collision().
+    void resolve_wall_collision(body &b)
+    {
+        glm::vec3 lo = world_[b.first], hi = world_[b.first];
+        for (unsigned int i = b.first; i < b.first + b.count; i++)
+        {
+            lo = glm::min(lo, world_[i]);
+            hi = glm::max(hi, world_[i]);
+        }
+        for (int a = 0; a < 3; a++)
+        {
+            float shift = lo[a] < 0.0f ? -lo[a] : (hi[a] > k_world_edge_size ? k_world_edge_size - hi[a] : 0.0f);
+            if (shift == 0.0f) continue;
+            b.position[a] += shift;
+            if (b.velocity[a] * shift < 0.0f) b.velocity[a] *= -0.5f;
+        }
+    }
+
+    void update_world_positions()
+    {
+        for (const body &b : bodies_)
+        {
+            #pragma omp parallel for
+            for (int i = b.first; i < (int)(b.first + b.count); i++)
+            {
+                world_[i] = b.position + b.rotation * local_[i];
+            }
+        }
+    }
+};
+
+#endif // RIGID_BODY_HPP_
@@ -0,0 +1,156 @@
+#ifndef SCALING_BENCHMARK_HPP_
+#define SCALING_BENCHMARK_HPP_
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include <cmath>
+
+#include <omp.h>
+
+#include "common.hpp"
+#include "simulation_config.hpp"
+#include "solver.hpp"
+
+struct ScalingOptions
+{
+    unsigned long num_step = 100;   // timed steps per run, after one warm-up step
+    int max_thread = 0;             // 0: omp_get_max_threads()
+    std::string csv_path;           // one row per run
+};
+
+namespace scaling
+{
+
+enum mode
+{
+    strong, weak
+};
+
+struct result
+{
+    mode m;
+    int num_thread;
+    unsigned int num_particle;
+    double seconds;                 // wall time of num_step steps
+    double steps_per_sec;
+    double particle_updates_per_sec;
+    double efficiency;              // relative to the 1-thread run of the same mode
+};
+
+} // namespace scaling
+
+
+// Fixed-step timing of Solver::compute_next_state() over OpenMP thread counts
+// 1, 2, 4, ..., max_thread.
+//   strong  the configured scene at every thread count; efficiency = t1 / (n * tn)
+//   weak    particles per thread held constant (num_particle_each_side scaled by
+//           sqrt(n)); efficiency = t1 / tn
+// Every run rebuilds the scene from the config, so with a non-zero seed and a fixed
+// scene preset all runs start from the same state and repeated invocations are comparable.
+class ScalingBenchmark
+{
+private:
+    std::vector<scaling::result> results_;
+
+public:
+    ScalingBenchmark() {};
+
+    bool run(const SimulationConfig &config, const ScalingOptions &options)
+    {
+        if (config.seed == 0)
+        {
+            std::cout << "warning: seed=0, initial states differ between runs" << std::endl;
+        }
+        int max_thread = options.max_thread > 0 ? options.max_thread : omp_get_max_threads();
+        std::vector<int> thread_counts;
+        for (int t = 1; t < max_thread; t *= 2) thread_counts.push_back(t);
+        thread_counts.push_back(max_thread);
+
+        results_.clear();
+        for (scaling::mode m : {scaling::strong, scaling::weak})
+        {
+            double t1 = 0.0;
+            for (int t : thread_counts)
+            {
+                SimulationConfig c = config;
+                if (m == scaling::weak)
+                {
+                    c.num_particle_each_side = std::lround(config.num_particle_each_side * std::sqrt((double)t));
+                }
+                if (!apply_simulation_config(c)) return false;
+
+                scaling::result r = measure(m, t, options.num_step);
+                if (t == thread_counts.front()) t1 = r.seconds;
+                r.efficiency = (m == scaling::strong) ? t1 / (t * r.seconds) : t1 / r.seconds;
+                results_.push_back(r);
+                print(r);
+            }
+        }
+        apply_simulation_config(config);
+
+        if (!options.csv_path.empty()) return write_csv(options.csv_path);
+        return true;
+    }
+
+    const std::vector<scaling::result> &get_results() const { return results_; }
+
+    bool write_csv(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file.is_open())
+        {
+            std::cout << "Failed to open scaling file: " << path << std::endl;
+            return false;
+        }
+        file << "mode,threads,particles,seconds,steps_per_sec,particle_updates_per_sec,efficiency\n";
+        for (const scaling::result &r : results_)
+        {
+            file << (r.m == scaling::strong ? "strong" : "weak") << "," << r.num_thread << "," << r.num_particle << ","
+                 << r.seconds << "," << r.steps_per_sec << "," << r.particle_updates_per_sec << "," << r.efficiency << "\n";
+        }
+        return true;
+    }
+
+    ~ScalingBenchmark() {};
+
+private:
+    static scaling::result measure(scaling::mode m, int num_thread, unsigned long num_step)
+    {
+        omp_set_num_threads(num_thread);
+        std::unique_ptr<Solver> solver(new Solver());
+        solver->get_profiler().set_enabled(false);
+        solver->compute_next_state();   // warm-up: first touch of the neighbour lists and k-d tree
+
+        auto t_begin = std::chrono::steady_clock::now();
+        for (unsigned long s = 0; s < num_step; s++) solver->compute_next_state();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_begin).count();
+
+        scaling::result r;
+        r.m = m;
+        r.num_thread = num_thread;
+        r.num_particle = k_num_particle;
+        r.seconds = seconds;
+        r.steps_per_sec = num_step / seconds;
+        r.particle_updates_per_sec = (double)num_step * k_num_particle / seconds;
+        r.efficiency = 1.0;
+        return r;
+    }
+
+    static void print(const scaling::result &r)
+    {
+        std::cout << std::setw(6) << (r.m == scaling::strong ? "strong" : "weak")
+                  << "  threads " << std::setw(3) << r.num_thread
+                  << "  particles " << std::setw(8) << r.num_particle
+                  << "  " << std::setw(9) << std::fixed << std::setprecision(2) << r.steps_per_sec << " steps/s"
+                  << "  " << std::setw(9) << std::setprecision(3) << r.particle_updates_per_sec * 1e-6 << " M particle-updates/s"
+                  << "  efficiency " << std::setprecision(2) << r.efficiency
+                  << std::defaultfloat << std::endl;
+    }
+};
+
+#endif // SCALING_BENCHMARK_HPP_
@@ -0,0 +1,218 @@
+#ifndef SIMULATION_CONFIG_HPP_
+#define SIMULATION_CONFIG_HPP_
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <vector>
+
+// Inflow nozzle: a disc at center facing direction, releasing rate particles/sec at
+// speed along direction. World units. An empty material emits the scene material.
+struct EmitterConfig
+{
+    float center[3];
+    float direction[3];
+    float radius;
+    float speed;
+    float rate;
+    std::string material;
+};
+
+// Outflow: particles entering the box lo..hi are removed. World units.
+struct SinkConfig
+{
+    float lo[3];
+    float hi[3];
+};
+
+// Rigid body coupled with the fluid: a box or the ellipsoid inscribed in it, centred
+// at center with full size extent. World units; density in kg/m^3.
+struct RigidBodyConfig
+{
+    bool ellipsoid;
+    float center[3];
+    float extent[3];
+    float density;
+};
+
+// Scene parameters chosen at startup. Load with load_file() / parse_assignment()
+// and hand to apply_simulation_config() (common.hpp) before constructing a Solver.
+//
+// File format: one `key = value` per line, `#` starts a comment.
+//   num_particle_each_side = 70
+//   world_edge_size        = 32
+//   material               = mercury      # water | mercury | air
+//   secondary_material     = water        # optional second fluid of the scene presets
+//   fluid_stiffness        = 1.0
+//   time_step              = 0.01
+//   integrator             = verlet       # verlet | ex_euler
+//   max_display_time       = 60
+//   num_neighboring_particle = 100
+//   scene                  = random       # random | dam_break | drop | tank | empty
+//   sampling               = lattice      # lattice | poisson, for the scene presets
+//   seed                   = 0            # 0: different initial state every run
+//   pool_capacity          = 0            # particle slots for emitters; 0: the initial count
+//   emitter                = cx cy cz  dx dy dz  radius speed rate [material]   # repeatable
+//   sink                   = x0 y0 z0  x1 y1 z1                                   # repeatable
+//   rigid_body             = box|ellipsoid  cx cy cz  ex ey ez  density             # repeatable
+//   force_field            = field.ffkg   # keyframed force field file; none: the electric field
+struct SimulationConfig
+{
+    unsigned int num_particle_each_side = 70;
+    int world_edge_size = 32;
+    std::string material = "mercury";
+    std::string secondary_material;
+    float fluid_stiffness = 1.0f;
+    float time_step = 0.01f;                // sec
+    std::string integrator = "verlet";
+    unsigned int max_display_time = 60;     // sec
+    unsigned int num_neighboring_particle = 100;
+    std::string scene = "random";
+    std::string sampling = "lattice";
+    unsigned int seed = 0;
+    unsigned int pool_capacity = 0;
+    std::vector<EmitterConfig> emitters;
+    std::vector<SinkConfig> sinks;
+    std::vector<RigidBodyConfig> rigid_bodies;
+    std::string force_field;
+
+    bool load_file(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file.is_open())
+        {
+            std::cout << "Failed to open config file: " << path << std::endl;
+            return false;
+        }
+        std::string line;
+        unsigned int line_no = 0;
+        while (std::getline(file, line))
+        {
+            line_no++;
+            line = line.substr(0, line.find('#'));
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            if (!parse_assignment(line))
+            {
+                std::cout << path << ":" << line_no << ": cannot parse \"" << line << "\"" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Consumes `--config FILE` or `key=value` at argv[i]; returns false if argv[i] is neither
+    // or fails to parse.
+    bool parse_argument(int &i, int argc, char **argv)
+    {
+        std::string arg = argv[i];
+        if (arg == "--config" && i + 1 < argc) return load_file(argv[++i]);
+        if (arg.compare(0, 2, "--") != 0 && arg.find('=') != std::string::npos) return parse_assignment(arg);
+        return false;
+    }
+
+    // "key=value" or "key = value"
+    bool parse_assignment(const std::string &assignment)
+    {
+        size_t eq = assignment.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = trim(assignment.substr(0, eq));
+        std::string value = trim(assignment.substr(eq + 1));
+        if (value.empty()) return false;
+
+        if (key == "num_particle_each_side") return parse_unsigned(value, num_particle_each_side);
+        else if (key == "world_edge_size") return parse_int(value, world_edge_size);
+        else if (key == "material") material = value;
+        else if (key == "secondary_material") secondary_material = value;
+        else if (key == "fluid_stiffness") return parse_float(value, fluid_stiffness);
+        else if (key == "time_step") return parse_float(value, time_step);
+        else if (key == "integrator") integrator = value;
+        else if (key == "max_display_time") return parse_unsigned(value, max_display_time);
+        else if (key == "num_neighboring_particle") return parse_unsigned(value, num_neighboring_particle);
+        else if (key == "scene") scene = value;
+        else if (key == "sampling") sampling = value;
+        else if (key == "seed") return parse_unsigned(value, seed);
+        else if (key == "pool_capacity") return parse_unsigned(value, pool_capacity);
+        else if (key == "force_field") force_field = value;
+        else if (key == "emitter")
+        {
+            EmitterConfig e;
+            std::istringstream is(value);
+            if (!(is >> e.center[0] >> e.center[1] >> e.center[2] >> e.direction[0] >> e.direction[1] >> e.direction[2]
+                     >> e.radius >> e.speed >> e.rate)) return false;
+            is >> e.material;   // optional
+            emitters.push_back(e);
+        }
+        else if (key == "sink")
+        {
+            SinkConfig k;
+            std::istringstream is(value);
+            if (!(is >> k.lo[0] >> k.lo[1] >> k.lo[2] >> k.hi[0] >> k.hi[1] >> k.hi[2])) return false;
+            sinks.push_back(k);
+        }
+        else if (key == "rigid_body")
+        {
+            RigidBodyConfig b;
+            std::string shape;
+            std::istringstream is(value);
+            if (!(is >> shape >> b.center[0] >> b.center[1] >> b.center[2] >> b.extent[0] >> b.extent[1] >> b.extent[2]
+                     >> b.density)) return false;
+            if (shape != "box" && shape != "ellipsoid") return false;
+            b.ellipsoid = shape == "ellipsoid";
+            rigid_bodies.push_back(b);
+        }
+        else return false;
+        return true;
+    }
+
+    // The whole value must be a number in range; "12abc", "" and "-1" (unsigned) fail.
+    // Also used for the command-line options of the programs.
+    static bool parse_long(const std::string &value, long &out)
+    {
+        char *end;
+        errno = 0;
+        out = std::strtol(value.c_str(), &end, 10);
+        return end != value.c_str() && *end == '\0' && errno != ERANGE;
+    }
+
+    static bool parse_int(const std::string &value, int &out)
+    {
+        long v;
+        if (!parse_long(value, v) || v < INT_MIN || v > INT_MAX) return false;
+        out = v;
+        return true;
+    }
+
+    static bool parse_unsigned(const std::string &value, unsigned int &out)
+    {
+        long v;
+        if (!parse_long(value, v) || v < 0 || (unsigned long)v > UINT_MAX) return false;
+        out = v;
+        return true;
+    }
+
+    static bool parse_float(const std::string &value, float &out)
+    {
+        char *end;
+        errno = 0;
+        float v = std::strtof(value.c_str(), &end);
+        if (end == value.c_str() || *end != '\0' || errno == ERANGE || !std::isfinite(v)) return false;
+        out = v;
+        return true;
+    }
+
+private:
+    static std::string trim(const std::string &s)
+    {
+        size_t b = s.find_first_not_of(" \t\r");
+        if (b == std::string::npos) return "";
+        size_t e = s.find_last_not_of(" \t\r");
+        return s.substr(b, e - b + 1);
+    }
+};
+
+#endif // SIMULATION_CONFIG_HPP_
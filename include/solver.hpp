@@ -4,6 +4,7 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <memory>
 
 #include <glm/glm.hpp>
 #include <omp.h>
@@ -14,77 +15,198 @@
 #include "particle.hpp"
 #include "collision_handler.hpp"
 #include "velocity_field.hpp"
+#include "force_field_grid.hpp"
+#include "profiler.hpp"
+#include "flow_boundary.hpp"
+#include "rigid_body.hpp"
 
-class Solver
+class SolverBase
+{
+public:
+    virtual void compute_next_state() = 0;
+    virtual void write_gl_particle_position(glm::vec3 *dst) = 0;
+    virtual std::vector<glm::vec3> &get_gl_particle_color() = 0;
+    virtual Particle &get_particles() = 0;
+    virtual RigidBodySystem &get_rigid_bodies() = 0;
+    virtual PhaseProfiler &get_profiler() = 0;
+    virtual void run_phase(profiler::phase p) = 0;
+    virtual ~SolverBase() {};
+};
+
+// Method and Kernel are fixed at compile time so the per-step dispatch and the
+// kernel calls in the neighbour loops are resolved statically.
+template <integrator Method, typename Kernel>
+class SphSolver : public SolverBase
 {
 private:
     Particle particles;
     cy::PointCloud<glm::vec3, float, 3> kdtree;
+    ForceFieldGrid electric_field_grid;
+    KeyframedForceFieldGrid keyframed_field_grid;
+    bool use_keyframed_field;
+    FlowBoundary flow_boundary;
+    RigidBodySystem rigid_bodies;
+    PhaseProfiler phase_profiler;
+
+    // compute_force_surface_tension() scratch
+    std::vector<glm::vec3> surface_normal_;
+    std::vector<unsigned int> surface_;     // free-surface particles of this step
+    std::vector<std::vector<unsigned int>> surface_chunk_;  // per thread, over a contiguous range
 
 public: 
-    Solver()
+    SphSolver()
+    : use_keyframed_field(false)
     {
+        if (!k_force_field_path.empty())
+        {
+            // the file was checked by apply_simulation_config(); this only fails if it changed since
+            use_keyframed_field = keyframed_field_grid.open(k_force_field_path);
+        }
+        if (!use_keyframed_field) electric_field_grid.bake(velocity_field::electric_field);
     };
 
-    void compute_next_state()
+    void compute_next_state() override
     {
-        compute_neighborhood();
+        const unsigned int num_active = particles.get_num_active();
+        {
+            ScopedPhaseTimer t(phase_profiler, profiler::neighborhood);
+            if (k_multi_material && particles.solver_step % k_material_sort_interval == 0) particles.sort_by_cell(k_sph_s);
+            compute_neighborhood();
+        }
 
-        switch (k_integration_method)
+        if constexpr (Method == integrator::ex_euler) integrated_by_ex_euler();
+        else if constexpr (Method == integrator::verlet) integrated_by_verlet();
+        else static_assert(Method == integrator::verlet, "integrator not implemented");
+
+        if (flow_boundary.is_enabled())
         {
-            case integrator::im_euler:
-                integrated_by_im_euler();
-                break;
-            case integrator::ex_euler:
-                integrated_by_ex_euler();
-                break;
-            case integrator::rk2:
-                integrated_by_rk2();
-                break;
-            case integrator::verlet:
-                integrated_by_verlet();
+            ScopedPhaseTimer t(phase_profiler, profiler::flow);
+            flow_boundary.apply(particles);
+        }
+
+        particles.solver_step++;
+        phase_profiler.end_step(num_active);
+    }
+
+    void write_gl_particle_position(glm::vec3 *dst) override { particles.write_gl_particle_position(dst); }
+    std::vector<glm::vec3> &get_gl_particle_color() override { return particles.get_gl_particle_color(); }
+    Particle &get_particles() override { return particles; }
+    RigidBodySystem &get_rigid_bodies() override { return rigid_bodies; }
+    PhaseProfiler &get_profiler() override { return phase_profiler; }
+
+    // Runs a single phase of compute_next_state() on the current state, for benchmarks.
+    void run_phase(profiler::phase p) override
+    {
+        switch (p)
+        {
+            case profiler::neighborhood: compute_neighborhood(); break;
+            case profiler::density:
+                std::fill_n(particles.density.begin(), particles.get_num_active(), 0.0f);
+                compute_density();
                 break;
-            default:
+            case profiler::pressure: compute_pressure(); break;
+            case profiler::force_pressure: compute_force_pressure(); break;
+            case profiler::force_diffusion: compute_force_diffusion(); break;
+            case profiler::force_gravity: compute_force_gravity(); break;
+            case profiler::force_surface_tension: compute_force_surface_tension(); break;
+            case profiler::collision: resolve_collision(); break;
+            case profiler::commit: commit_next_state(); break;
+            case profiler::flow: flow_boundary.apply(particles); break;
+            case profiler::rigid:
+                rigid_bodies.find_contacts(particles);
+                rigid_bodies.integrate(k_time_step);
                 break;
+            default: break;     // predict / integrate are fused into the integrator
         }
     }
 
-    std::vector<glm::vec3> &get_gl_particle_position() { return particles.get_gl_particle_position(); }
-    std::vector<glm::vec3> &get_gl_particle_color() { return particles.get_gl_particle_color(); }
-
-    ~Solver()
+    ~SphSolver()
     {
     };
 
 private:
     void integrated_by_verlet()
     {
-        #pragma omp parallel for
-        for (int i = 0; i < k_num_particle; i++)
+        const int n = particles.get_num_active();
         {
-            particles.next_position.at(i) = particles.position.at(i)
-                + particles.velocity.at(i) * k_time_step
-                + particles.acceleration.at(i) * (float)std::pow(k_time_step, 2) / 2.0f;
+            ScopedPhaseTimer t(phase_profiler, profiler::predict);
+            #pragma omp parallel for
+            for (int i = 0; i < n; i++)
+            {
+                particles.next_position.at(i) = particles.position.at(i)
+                    + particles.velocity.at(i) * k_time_step
+                    + particles.acceleration.at(i) * (float)std::pow(k_time_step, 2) / 2.0f;
+            }
         }
         
         compute_applied_forces();   // using next_position
 
-        #pragma omp parallel for
-        for (int i = 0; i < k_num_particle; i++)
         {
-            particles.next_acceleration.at(i) = particles.force.at(i) / particles.density.at(i);
+            ScopedPhaseTimer t(phase_profiler, profiler::integrate);
+            #pragma omp parallel for
+            for (int i = 0; i < n; i++)
+            {
+                particles.next_acceleration.at(i) = particles.force.at(i) / particles.density.at(i);
+            }
+            
+            #pragma omp parallel for
+            for (int i = 0; i < n; i++)
+            {
+                particles.next_velocity.at(i) = particles.velocity.at(i) 
+                    + (particles.acceleration.at(i) + particles.next_acceleration.at(i)) * k_time_step / 2.0f;
+            }
         }
+        integrate_rigid_bodies();
         
-        
-        #pragma omp parallel for
-        for (int i = 0; i < k_num_particle; i++)
+        resolve_collision();
+        commit_next_state();
+    }
+
+    // semi-implicit: forces at the current position (next_position == position here)
+    void integrated_by_ex_euler()
+    {
+        const int n = particles.get_num_active();
+        compute_applied_forces();
+
         {
-            particles.next_velocity.at(i) = particles.velocity.at(i) 
-                + (particles.acceleration.at(i) + particles.next_acceleration.at(i)) * k_time_step / 2.0f;
+            ScopedPhaseTimer t(phase_profiler, profiler::integrate);
+            #pragma omp parallel for
+            for (int i = 0; i < n; i++)
+            {
+                particles.next_acceleration.at(i) = particles.force.at(i) / particles.density.at(i);
+                particles.next_velocity.at(i) = particles.velocity.at(i) + particles.next_acceleration.at(i) * k_time_step;
+                particles.next_position.at(i) = particles.position.at(i) + particles.next_velocity.at(i) * k_time_step;
+            }
         }
-        
+        integrate_rigid_bodies();
+
+        resolve_collision();
+        commit_next_state();
+    }
+
+    // the bodies move with the reactions gathered in compute_applied_forces()
+    void integrate_rigid_bodies()
+    {
+        if (!rigid_bodies.is_enabled()) return;
+        ScopedPhaseTimer t(phase_profiler, profiler::rigid);
+        rigid_bodies.integrate(k_time_step);
+    }
+
+    void commit_next_state()
+    {
+        const int n = particles.get_num_active();
+        ScopedPhaseTimer t(phase_profiler, profiler::commit);
+        std::copy_n(particles.next_position.begin(), n, particles.position.begin());
+        std::copy_n(particles.next_velocity.begin(), n, particles.velocity.begin());
+        std::copy_n(particles.next_acceleration.begin(), n, particles.acceleration.begin());
+    }
+
+    void resolve_collision()
+    {
+        const int n = particles.get_num_active();
+        ScopedPhaseTimer t(phase_profiler, profiler::collision);
         #pragma omp parallel for
-        for (int i = 0; i < k_num_particle; i++)
+        for (int i = 0; i < n; i++)
         {
             collision::result ret = collision::detect_collision(particles.position.at(i), particles.next_position.at(i),
                                                                 particles.velocity.at(i), particles.next_velocity.at(i));
@@ -94,38 +216,57 @@ private:
                 particles.next_velocity.at(i) = ret.new_vel;
             }
         }
-
-        particles.position = particles.next_position;
-        particles.velocity = particles.next_velocity;
-        particles.acceleration = particles.next_acceleration;        
     }
 
-    void integrated_by_ex_euler() {}
-    void integrated_by_im_euler() {}
-    void integrated_by_rk2() {}
-
     void compute_applied_forces()
     {
-        std::fill(particles.density.begin(), particles.density.end(), 0.0f);
-        compute_density();
-        compute_pressure();
+        const int n = particles.get_num_active();
+        if (rigid_bodies.is_enabled())
+        {
+            ScopedPhaseTimer t(phase_profiler, profiler::rigid);
+            rigid_bodies.find_contacts(particles);
+        }
+        {
+            ScopedPhaseTimer t(phase_profiler, profiler::density);
+            std::fill_n(particles.density.begin(), n, 0.0f);
+            compute_density();
+            if (rigid_bodies.is_enabled()) rigid_bodies.add_density<Kernel>(particles);
+        }
+        {
+            ScopedPhaseTimer t(phase_profiler, profiler::pressure);
+            compute_pressure();
+        }
 
-        std::fill(particles.force.begin(), particles.force.end(), glm::vec3({0.0f, 0.0f, 0.0f}));
-        compute_force_pressure();
-        compute_force_diffusion();
-        compute_force_gravity();
-        compute_force_surface_tension();
+        std::fill_n(particles.force.begin(), n, glm::vec3({0.0f, 0.0f, 0.0f}));
+        {
+            ScopedPhaseTimer t(phase_profiler, profiler::force_pressure);
+            compute_force_pressure();
+            if (rigid_bodies.is_enabled()) rigid_bodies.add_force_pressure<Kernel>(particles);
+        }
+        {
+            ScopedPhaseTimer t(phase_profiler, profiler::force_diffusion);
+            compute_force_diffusion();
+        }
+        {
+            ScopedPhaseTimer t(phase_profiler, profiler::force_gravity);
+            compute_force_gravity();
+        }
+        {
+            ScopedPhaseTimer t(phase_profiler, profiler::force_surface_tension);
+            compute_force_surface_tension();
+        }
     }
 
     void compute_neighborhood()
     {  
-        for(int i = 0; i < k_num_particle; i++) { neighborhood.at(i).clear(); }
+        const int n = particles.get_num_active();
+        for(int i = 0; i < n; i++) { neighborhood.at(i).clear(); }
 
         glm::vec3 *pos = &particles.next_position[0];
-        kdtree.Build(k_num_particle, pos);
+        kdtree.Build(n, pos);
 
         #pragma omp parallel for 
-        for (int i = 0; i < k_num_particle; i++)
+        for (int i = 0; i < n; i++)
         {
             kdtree.GetPoints(i, particles.next_position.at(i), k_sph_s, compute_neighborhood_callback);
         }
@@ -136,94 +277,179 @@ private:
         neighborhood.at(target_index).push_back(index);
     }
 
+    // rho_i = m_i * sum_j W_ij: with one material this is the usual sum_j m_j W_ij, and at
+    // an interface it keeps a light particle from picking up its heavy neighbours' mass
     void compute_density()
     {
+        const int n = particles.get_num_active();
         #pragma omp parallel for collapse(1)
-        for (int i = 0; i < k_num_particle; i++)
+        for (int i = 0; i < n; i++)
         {
+            const float mass = k_material_table.particle_mass[particles.material_id[i]];
             for (unsigned int j : neighborhood.at(i))
             {
-                particles.density.at(i) += k_particle_mass * sph_default_kernel(particles.next_position.at(i) - particles.next_position.at(j));
+                particles.density.at(i) += mass * Kernel::density(particles.next_position.at(i) - particles.next_position.at(j));
             }
         }
     }
 
     void compute_pressure()
     {
+        const int n = particles.get_num_active();
         #pragma omp parallel for 
-        for (int i = 0; i < k_num_particle; i++)
+        for (int i = 0; i < n; i++)
         {
-            particles.pressure.at(i) = k_fluid_stiffness * (particles.density.at(i) - k_fluid_property.density);
+            particles.pressure.at(i) = k_fluid_stiffness * (particles.density.at(i) - k_material_table.rest_density[particles.material_id[i]]);
         }
     }
 
     void compute_force_pressure()
     {
+        const int n = particles.get_num_active();
         #pragma omp parallel for collapse(1)
-        for (int i = 0; i < k_num_particle; i++)
+        for (int i = 0; i < n; i++)
         {
             glm::vec3 pressure_gradient = {0.0f, 0.0f, 0.0f};
             for (auto j : neighborhood.at(i))
             {
                 if (i == j) continue;
-                pressure_gradient += k_particle_mass 
+                pressure_gradient += k_material_table.particle_mass[particles.material_id[j]]
                     * (float)((particles.density.at(i) / std::pow(particles.density.at(j), 2)) + (particles.density.at(j) / std::pow(particles.density.at(i), 2))) 
-                    * sph_pressure_kernel_gradient(particles.next_position.at(i) - particles.next_position.at(j));
+                    * Kernel::pressure_gradient(particles.next_position.at(i) - particles.next_position.at(j));
             }
-            particles.force.at(i) -= 0.0002f * particles.density.at(i) * pressure_gradient;
+            particles.force.at(i) -= k_pressure_force_scale * particles.density.at(i) * pressure_gradient;
         }
     }
 
     void compute_force_diffusion()
     {
+        const int n = particles.get_num_active();
+        if (use_keyframed_field) keyframed_field_grid.advance_to(particles.solver_step * k_time_step);
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+        {
+            const glm::vec3 &p = particles.next_position[i];
+            particles.field_velocity[i] = use_keyframed_field ? keyframed_field_grid.sample(p) : electric_field_grid.sample(p);
+        }
+
         #pragma omp parallel for collapse(1)
-        for (int i = 0; i < k_num_particle; i++)
+        for (int i = 0; i < n; i++)
         {
             glm::vec3 laplacian = {0.0f, 0.0f, 0.0f};
             for (auto j : neighborhood.at(i))
             {
                 if (i == j) continue;
                
-                laplacian += (velocity_field::electric_field(particles.next_position.at(j)) - velocity_field::electric_field(particles.next_position.at(i)))
-                    * (k_particle_mass / particles.density.at(i))
-                    * sph_diffusion_kernel_laplacian(particles.next_position.at(i) - particles.next_position.at(j));
+                laplacian += (particles.field_velocity.at(j) - particles.field_velocity.at(i))
+                    * (k_material_table.particle_mass[particles.material_id[j]] / particles.density.at(i))
+                    * Kernel::viscosity_laplacian(particles.next_position.at(i) - particles.next_position.at(j));
             }
 
-            particles.force.at(i) += 0.01f * k_fluid_property.dynamic * laplacian;
+            particles.force.at(i) += 0.01f * k_material_table.dynamic[particles.material_id[i]] * laplacian;
         }
     }
 
     void compute_force_gravity()
     {
+        const int n = particles.get_num_active();
         #pragma omp parallel for 
-        for (int i = 0; i < k_num_particle; i++)
+        for (int i = 0; i < n; i++)
         {
             particles.force.at(i) += particles.density.at(i) * k_gravity_acceleration;
         }
     }
 
+    // Akinci et al. 2013: cohesion + curvature, symmetrized by K_ij = 2 rho0_i / (rho_i + rho_j),
+    // with neighbour volumes in place of masses. The color-field gradient n_i is cheap and
+    // needed by every neighbour's curvature term, so it is computed for all particles; the
+    // pair forces then run only over the free-surface particles it detects.
     void compute_force_surface_tension()
     {
-        #pragma omp parallel for collapse(1)
-        for (int i = 0; i < k_num_particle; i++)
+        const int n = particles.get_num_active();
+        surface_normal_.resize(n);
+        // each thread lists the surface particles of its own index range, so the
+        // concatenation below is in index order whatever the thread count
+        const int num_chunk = omp_get_max_threads();
+        surface_chunk_.resize(num_chunk);
+        #pragma omp parallel for schedule(static)
+        for (int t = 0; t < num_chunk; t++)
         {
-            glm::vec3 surface_normal = {0.0f, 0.0f, 0.0f};
-            float laplacian = 0.0f;
-            for (auto j : neighborhood.at(i)) 
+            std::vector<unsigned int> &chunk = surface_chunk_[t];
+            chunk.clear();
+            for (int i = (int64_t)n * t / num_chunk; i < (int64_t)n * (t + 1) / num_chunk; i++)
             {
-                if (i == j) continue;
-                surface_normal += (k_particle_mass / particles.density.at(j)) * sph_default_kernel_gradient(particles.next_position.at(i) - particles.next_position.at(j)); 
-                laplacian += (k_particle_mass / particles.density.at(j)) * sph_default_kernel_laplacian(particles.next_position.at(i) - particles.next_position.at(j));
+                glm::vec3 gradient = {0.0f, 0.0f, 0.0f};
+                for (auto j : neighborhood.at(i))
+                {
+                    if (i == (int)j) continue;
+                    const float volume = k_material_table.particle_mass[particles.material_id[j]] / particles.density.at(j);
+                    gradient += volume * Kernel::density_gradient(particles.next_position.at(i) - particles.next_position.at(j));
+                }
+                surface_normal_[i] = k_sph_s * gradient;
+                if (glm::dot(surface_normal_[i], surface_normal_[i]) > k_surface_tension_level_threshold * k_surface_tension_level_threshold) chunk.push_back(i);
             }
-            surface_normal = glm::normalize(surface_normal);
-            if(glm::length(surface_normal) > k_surface_tension_level_threshold)
+        }
+
+        surface_.clear();
+        for (const std::vector<unsigned int> &chunk : surface_chunk_) surface_.insert(surface_.end(), chunk.begin(), chunk.end());
+
+        const int num_surface = surface_.size();
+        #pragma omp parallel for
+        for (int k = 0; k < num_surface; k++)
+        {
+            const unsigned int i = surface_[k];
+            const float rest_density = k_material_table.rest_density[particles.material_id[i]];
+            glm::vec3 acceleration = {0.0f, 0.0f, 0.0f};
+            for (auto j : neighborhood.at(i))
             {
-                particles.force.at(i) -= 0.01f * k_fluid_property.surface_tension * surface_normal * laplacian ;
+                glm::vec3 r = particles.next_position.at(i) - particles.next_position.at(j);
+                float r_len = glm::length(r);
+                if (r_len <= 0.0f) continue;    // i itself, or a coincident particle
+                const float volume = k_material_table.particle_mass[particles.material_id[j]] / particles.density.at(j);
+                const float correction = 2.0f * rest_density / (particles.density.at(i) + particles.density.at(j));
+                acceleration -= correction * (volume * Kernel::cohesion(r_len) / r_len * r + (surface_normal_[i] - surface_normal_[j]));
             }
+            particles.force.at(i) += 0.01f * k_material_table.surface_tension[particles.material_id[i]] * particles.density.at(i) * acceleration;
         }
-
     }
 
 };
 
+// Runtime front end: instantiates the SphSolver matching k_integration_method.
+class Solver
+{
+private:
+    std::unique_ptr<SolverBase> impl;
+
+public:
+    Solver()
+    {
+        switch (k_integration_method)
+        {
+            case integrator::ex_euler:
+                impl.reset(new SphSolver<integrator::ex_euler, StandardKernel>());
+                break;
+            case integrator::verlet:
+                impl.reset(new SphSolver<integrator::verlet, StandardKernel>());
+                break;
+            default:
+                std::cout << "Integrator not implemented, falling back to verlet" << std::endl;
+                impl.reset(new SphSolver<integrator::verlet, StandardKernel>());
+                break;
+        }
+    };
+
+    void compute_next_state() { impl->compute_next_state(); }
+    void write_gl_particle_position(glm::vec3 *dst) { impl->write_gl_particle_position(dst); }
+    std::vector<glm::vec3> &get_gl_particle_color() { return impl->get_gl_particle_color(); }
+    Particle &get_particles() { return impl->get_particles(); }
+    RigidBodySystem &get_rigid_bodies() { return impl->get_rigid_bodies(); }
+    PhaseProfiler &get_profiler() { return impl->get_profiler(); }
+    void run_phase(profiler::phase p) { impl->run_phase(p); }
+
+    ~Solver()
+    {
+    };
+};
+
 #endif // SOLVER_H_
\ No newline at end of file
@@ -0,0 +1,505 @@
+#ifndef SURFACE_MESHER_HPP_
+#define SURFACE_MESHER_HPP_
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <omp.h>
+#include <tbb/tbb.h>
+#include <cyCodeBase/cyTriMesh.h>
+
+#include "common.hpp"
+#include "particle.hpp"
+
+// Marching cubes case table, generated once instead of transcribed: for every corner
+// configuration the isosurface crossings on each cube face are joined into segments,
+// the segments are chained into closed loops and each loop is fanned into triangles.
+// An ambiguous face (two diagonal inside corners) always separates the inside corners,
+// which both cubes sharing the face agree on, so the surface is watertight.
+//
+// Corner c sits at (c & 1, c >> 1 & 1, c >> 2 & 1). Edge a * 4 + k runs along axis a from
+// the k-th corner with bit a clear.
+namespace marching_cubes
+{
+
+struct table
+{
+    unsigned char edge_corner[12][2];
+    std::vector<unsigned char> triangles[256];     // edge ids, three per triangle, outward facing
+};
+
+inline glm::vec3 corner_position(int c) { return glm::vec3(c & 1, (c >> 1) & 1, (c >> 2) & 1); }
+
+inline bool on_one_face(const table &t, int e0, int e1, int e2)
+{
+    int all = 7, none = 7;      // coordinate bits set at every / no endpoint
+    for (int e : {e0, e1, e2})
+    {
+        for (int c : t.edge_corner[e])
+        {
+            all &= c;
+            none &= ~c;
+        }
+    }
+    return (all | none) != 0;
+}
+
+inline table build_table()
+{
+    table t;
+    int edge_of[8][8];
+    for (int a = 0, e = 0; a < 3; a++)
+    {
+        for (int c = 0; c < 8; c++)
+        {
+            if (c & (1 << a)) continue;
+            t.edge_corner[e][0] = c;
+            t.edge_corner[e][1] = c | (1 << a);
+            edge_of[c][c | (1 << a)] = edge_of[c | (1 << a)][c] = e;
+            e++;
+        }
+    }
+
+    for (int config = 0; config < 256; config++)
+    {
+        // directed segments, entering crossing -> leaving crossing, walking each face
+        // counter-clockwise as seen from outside the cube
+        int next[12];
+        std::fill(next, next + 12, -1);
+        for (int a = 0; a < 3; a++)
+        {
+            int u = 1 << ((a + 1) % 3), v = 1 << ((a + 2) % 3);
+            for (int side = 0; side < 2; side++)
+            {
+                int base = side ? (1 << a) : 0;
+                int q[4] = {base, base | u, base | u | v, base | v};
+                if (!side) std::swap(q[1], q[3]);
+                // crossings alternate entering / leaving; each entering one is joined
+                // to the next crossing, which keeps diagonal inside corners apart
+                int cross[4], num_cross = 0;
+                bool entering[4];
+                for (int k = 0; k < 4; k++)
+                {
+                    bool in0 = (config >> q[k]) & 1, in1 = (config >> q[(k + 1) % 4]) & 1;
+                    if (in0 == in1) continue;
+                    entering[num_cross] = in1;
+                    cross[num_cross++] = edge_of[q[k]][q[(k + 1) % 4]];
+                }
+                for (int k = 0; k < num_cross; k++)
+                {
+                    if (entering[k]) next[cross[k]] = cross[(k + 1) % num_cross];
+                }
+            }
+        }
+
+        bool used[12] = {};
+        for (int start = 0; start < 12; start++)
+        {
+            if (next[start] < 0 || used[start]) continue;
+            std::vector<int> loop;
+            for (int e = start; !used[e]; e = next[e])
+            {
+                used[e] = true;
+                loop.push_back(e);
+            }
+            // fan from the first apex whose triangles do not lie flat in a cube face,
+            // which a neighbouring cube would repeat with the opposite winding
+            unsigned int apex = 0;
+            for (unsigned int r = 0; r < loop.size(); r++)
+            {
+                bool flat = false;
+                for (unsigned int k = 1; k + 1 < loop.size(); k++)
+                {
+                    flat = flat || on_one_face(t, loop[r], loop[(r + k) % loop.size()], loop[(r + k + 1) % loop.size()]);
+                }
+                if (!flat)
+                {
+                    apex = r;
+                    break;
+                }
+            }
+            for (unsigned int k = 1; k + 1 < loop.size(); k++)
+            {
+                t.triangles[config].push_back(loop[apex]);
+                t.triangles[config].push_back(loop[(apex + k) % loop.size()]);
+                t.triangles[config].push_back(loop[(apex + k + 1) % loop.size()]);
+            }
+        }
+    }
+
+    // orient every triangle away from the inside, checked on the single-corner case
+    auto mid = [&](int e) { return 0.5f * (corner_position(t.edge_corner[e][0]) + corner_position(t.edge_corner[e][1])); };
+    const std::vector<unsigned char> &probe = t.triangles[1];
+    glm::vec3 normal = glm::cross(mid(probe[1]) - mid(probe[0]), mid(probe[2]) - mid(probe[0]));
+    if (glm::dot(normal, mid(probe[0]) - corner_position(0)) < 0)
+    {
+        for (std::vector<unsigned char> &tri : t.triangles)
+            for (unsigned int k = 0; k < tri.size(); k += 3) std::swap(tri[k + 1], tri[k + 2]);
+    }
+    return t;
+}
+
+inline const table &get_table()
+{
+    static const table t = build_table();
+    return t;
+}
+
+} // namespace marching_cubes
+
+
+// Triangle surface of the fluid for rendering, one per frame.
+//
+// The field phi(x) = sum_j V W(x - x_j), with the rest volume V per particle and a poly6
+// kernel of radius R (twice the rest spacing, at least k_sph_s), is ~1 inside the fluid;
+// the mesh is its 0.5 isosurface. Particles are binned into cubes of edge R (a sorted cell
+// list), and only bins on the boundary between occupied and empty space are refined into
+// marching cubes cells. Wherever the surface leaves the refined region through a cell
+// face, the bin behind that face is refined too, until the surface closes; field
+// evaluation and triangle generation therefore scale with the surface area. Space outside
+// the box counts as empty, so the mesh is closed along the walls.
+class SurfaceMesher
+{
+private:
+    static const int k_subdivision = 2;                 // marching cubes cells per bin and axis
+    static constexpr float k_iso_level = 0.5f;
+    static const int64_t k_key_offset = 1 << 19;        // keys pack three 20-bit lattice coordinates
+
+    float radius_;          // kernel radius and bin size
+    float cell_size_;       // marching cubes cell
+    float poly6_coef_;
+    float particle_volume_;
+
+    std::vector<std::pair<uint64_t, unsigned int>> binned_;     // (bin key, particle), sorted
+    std::vector<uint64_t> bin_key_;                             // occupied bins, sorted
+    std::vector<unsigned int> bin_begin_;                       // particles of bin_key_[b] in binned_[bin_begin_[b], bin_begin_[b + 1])
+    std::vector<glm::vec3> binned_position_;                    // position of binned_[k], contiguous per bin
+
+    // refined region, all sorted by key
+    std::vector<uint64_t> active_bin_;
+    std::vector<uint64_t> active_cell_;
+    std::vector<std::pair<uint64_t, float>> node_;              // (lattice point, phi)
+
+public:
+    SurfaceMesher()
+    {
+        // wide enough that neighbouring particles at rest spacing overlap
+        const float spacing = std::cbrt(k_fluid_volume / k_num_particle);
+        radius_ = std::max(k_sph_s, 2.0f * spacing);
+        cell_size_ = radius_ / k_subdivision;
+        poly6_coef_ = 315 / (64 * M_PI * std::pow(radius_, 9));
+        particle_volume_ = k_fluid_volume / k_num_particle;
+    };
+
+    static uint64_t pack(int64_t x, int64_t y, int64_t z)
+    {
+        return (uint64_t)(x + k_key_offset) << 40 | (uint64_t)(y + k_key_offset) << 20 | (uint64_t)(z + k_key_offset);
+    }
+    static glm::ivec3 unpack(uint64_t key)
+    {
+        const uint64_t mask = (1 << 20) - 1;
+        return glm::ivec3((int)((key >> 40) & mask) - k_key_offset, (int)((key >> 20) & mask) - k_key_offset, (int)(key & mask) - k_key_offset);
+    }
+
+    // Replaces mesh with the isosurface of the active particles, in world units.
+    void build(Particle &particles, cy::TriMesh &mesh)
+    {
+        bin_particles(particles);
+        active_bin_.clear();
+        active_cell_.clear();
+        node_.clear();
+        std::vector<uint64_t> bins = find_boundary_bins();
+        while (!bins.empty())
+        {
+            bins = find_escaping_bins(refine(bins));
+        }
+        polygonize(mesh);
+    }
+
+    bool write_obj(const std::string &path, Particle &particles)
+    {
+        cy::TriMesh mesh;
+        build(particles, mesh);
+        if (!mesh.SaveToFileObj(path.c_str(), &std::cout))
+        {
+            std::cout << "Failed to write mesh: " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    ~SurfaceMesher() {};
+
+private:
+    glm::ivec3 bin_of(const glm::vec3 &p) const
+    {
+        return glm::ivec3((int)std::floor(p.x / radius_), (int)std::floor(p.y / radius_), (int)std::floor(p.z / radius_));
+    }
+
+    static bool contains(const std::vector<uint64_t> &sorted, uint64_t key) { return std::binary_search(sorted.begin(), sorted.end(), key); }
+
+    static void sort_unique(std::vector<uint64_t> &v)
+    {
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    }
+
+    // threads hold contiguous, ordered ranges under schedule(static), so this keeps loop order
+    template <typename T>
+    static std::vector<T> concatenate(const std::vector<std::vector<T>> &per_thread)
+    {
+        std::vector<T> v;
+        for (const std::vector<T> &t : per_thread) v.insert(v.end(), t.begin(), t.end());
+        return v;
+    }
+
+    void bin_particles(Particle &particles)
+    {
+        const int n = particles.get_num_active();
+        binned_.resize(n);
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+        {
+            glm::ivec3 b = bin_of(particles.position[i]);
+            binned_[i] = {pack(b.x, b.y, b.z), (unsigned int)i};
+        }
+        tbb::parallel_sort(binned_.begin(), binned_.end());
+        binned_position_.resize(n);
+        #pragma omp parallel for
+        for (int k = 0; k < n; k++) binned_position_[k] = particles.position[binned_[k].second];
+
+        bin_key_.clear();
+        bin_begin_.clear();
+        for (int i = 0; i < n; i++)
+        {
+            if (i == 0 || binned_[i].first != binned_[i - 1].first)
+            {
+                bin_key_.push_back(binned_[i].first);
+                bin_begin_.push_back(i);
+            }
+        }
+        bin_begin_.push_back(n);
+    }
+
+    // Bins that are empty (or outside the box) next to an occupied one, or occupied next
+    // to an empty one.
+    std::vector<uint64_t> find_boundary_bins() const
+    {
+        const int num_bin = bin_key_.size();
+        const int num_bin_per_axis = (int)std::ceil(k_world_edge_size / radius_);
+        std::vector<std::vector<uint64_t>> per_thread(omp_get_max_threads());
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < num_bin; b++)
+        {
+            std::vector<uint64_t> &out = per_thread[omp_get_thread_num()];
+            glm::ivec3 c = unpack(bin_key_[b]);
+            bool boundary = false;
+            for (int dz = -1; dz <= 1; dz++)
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        glm::ivec3 d(c.x + dx, c.y + dy, c.z + dz);
+                        uint64_t key = pack(d.x, d.y, d.z);
+                        bool outside = std::min(d.x, std::min(d.y, d.z)) < 0 || std::max(d.x, std::max(d.y, d.z)) >= num_bin_per_axis;
+                        if (outside || !contains(bin_key_, key))
+                        {
+                            out.push_back(key);
+                            boundary = true;
+                        }
+                    }
+            if (boundary) out.push_back(bin_key_[b]);
+        }
+        std::vector<uint64_t> bins = concatenate(per_thread);
+        sort_unique(bins);
+        return bins;
+    }
+
+    // Adds the cells of bins (sorted, not yet active) to the refined region and evaluates
+    // phi at their new lattice points; returns the new cells.
+    std::vector<uint64_t> refine(const std::vector<uint64_t> &bins)
+    {
+        const int d = k_subdivision;
+        std::vector<uint64_t> cells(bins.size() * d * d * d);
+        #pragma omp parallel for
+        for (int b = 0; b < (int)bins.size(); b++)
+        {
+            glm::ivec3 c = unpack(bins[b]);
+            for (int k = 0; k < d * d * d; k++)
+            {
+                cells[(size_t)b * d * d * d + k] = pack(c.x * d + k % d, c.y * d + (k / d) % d, c.z * d + k / (d * d));
+            }
+        }
+        std::sort(cells.begin(), cells.end());
+
+        std::vector<uint64_t> corners(cells.size() * 8);
+        #pragma omp parallel for
+        for (int c = 0; c < (int)cells.size(); c++)
+        {
+            glm::ivec3 p = unpack(cells[c]);
+            for (int k = 0; k < 8; k++) corners[(size_t)c * 8 + k] = pack(p.x + (k & 1), p.y + ((k >> 1) & 1), p.z + ((k >> 2) & 1));
+        }
+        tbb::parallel_sort(corners.begin(), corners.end());
+        corners.erase(std::unique(corners.begin(), corners.end()), corners.end());
+
+        std::vector<std::pair<uint64_t, float>> nodes;
+        for (uint64_t key : corners)
+        {
+            auto it = std::lower_bound(node_.begin(), node_.end(), std::make_pair(key, -HUGE_VALF));
+            if (it == node_.end() || it->first != key) nodes.push_back({key, 0.0f});
+        }
+        #pragma omp parallel for
+        for (int v = 0; v < (int)nodes.size(); v++)
+        {
+            glm::ivec3 q = unpack(nodes[v].first);
+            nodes[v].second = evaluate(cell_size_ * glm::vec3(q.x, q.y, q.z));
+        }
+
+        merge_into(active_bin_, bins);
+        merge_into(active_cell_, cells);
+        merge_into(node_, nodes);
+        return cells;
+    }
+
+    template <typename T>
+    static void merge_into(std::vector<T> &dst, const std::vector<T> &src)
+    {
+        size_t middle = dst.size();
+        dst.insert(dst.end(), src.begin(), src.end());
+        std::inplace_merge(dst.begin(), dst.begin() + middle, dst.end());
+    }
+
+    float evaluate(const glm::vec3 &x) const
+    {
+        const float r2 = radius_ * radius_;
+        glm::ivec3 lo = bin_of(x - radius_), hi = bin_of(x + radius_);     // 2 or 3 bins per axis
+        float phi = 0.0f;
+        for (int bz = lo.z; bz <= hi.z; bz++)
+            for (int by = lo.y; by <= hi.y; by++)
+                for (int bx = lo.x; bx <= hi.x; bx++)
+                {
+                    uint64_t key = pack(bx, by, bz);
+                    auto it = std::lower_bound(bin_key_.begin(), bin_key_.end(), key);
+                    if (it == bin_key_.end() || *it != key) continue;
+                    size_t bin = it - bin_key_.begin();
+                    for (unsigned int k = bin_begin_[bin]; k < bin_begin_[bin + 1]; k++)
+                    {
+                        glm::vec3 r = x - binned_position_[k];
+                        float q2 = r2 - glm::dot(r, r);
+                        if (q2 > 0.0f) phi += q2 * q2 * q2;
+                    }
+                }
+        return particle_volume_ * poly6_coef_ * phi;
+    }
+
+    float node_value(uint64_t key) const
+    {
+        return std::lower_bound(node_.begin(), node_.end(), std::make_pair(key, -HUGE_VALF))->second;
+    }
+
+    int cell_config(const glm::ivec3 &p, uint64_t *corner_key, float *value) const
+    {
+        int config = 0;
+        for (int k = 0; k < 8; k++)
+        {
+            corner_key[k] = pack(p.x + (k & 1), p.y + ((k >> 1) & 1), p.z + ((k >> 2) & 1));
+            value[k] = node_value(corner_key[k]);
+            if (value[k] >= k_iso_level) config |= 1 << k;
+        }
+        return config;
+    }
+
+    // Inactive bins behind a face of cells that the surface crosses.
+    std::vector<uint64_t> find_escaping_bins(const std::vector<uint64_t> &cells) const
+    {
+        std::vector<std::vector<uint64_t>> per_thread(omp_get_max_threads());
+        #pragma omp parallel for schedule(static)
+        for (int c = 0; c < (int)cells.size(); c++)
+        {
+            glm::ivec3 p = unpack(cells[c]);
+            uint64_t corner_key[8];
+            float value[8];
+            int config = cell_config(p, corner_key, value);
+            if (config == 0 || config == 255) continue;
+            for (int a = 0; a < 3; a++)
+            {
+                for (int side = 0; side < 2; side++)
+                {
+                    int inside = 0;
+                    for (int k = 0; k < 8; k++) if (((k >> a) & 1) == side) inside += (config >> k) & 1;
+                    if (inside == 0 || inside == 4) continue;
+                    glm::ivec3 q = p;
+                    q[a] += side ? 1 : -1;
+                    glm::ivec3 b = {floor_div(q.x), floor_div(q.y), floor_div(q.z)};
+                    uint64_t key = pack(b.x, b.y, b.z);
+                    if (!contains(active_bin_, key)) per_thread[omp_get_thread_num()].push_back(key);
+                }
+            }
+        }
+        std::vector<uint64_t> bins = concatenate(per_thread);
+        sort_unique(bins);
+        return bins;
+    }
+
+    static int floor_div(int x) { return x >= 0 ? x / k_subdivision : -((-x + k_subdivision - 1) / k_subdivision); }
+
+    void polygonize(cy::TriMesh &mesh)
+    {
+        const marching_cubes::table &table = marching_cubes::get_table();
+
+        // triangle corners as (edge key, position); edge key = lower node key << 2 | axis
+        struct vertex { uint64_t edge; glm::vec3 position; };
+        std::vector<std::vector<vertex>> per_thread(omp_get_max_threads());
+        #pragma omp parallel for schedule(static)
+        for (int c = 0; c < (int)active_cell_.size(); c++)
+        {
+            glm::ivec3 p = unpack(active_cell_[c]);
+            uint64_t corner_key[8];
+            float value[8];
+            const std::vector<unsigned char> &tri = table.triangles[cell_config(p, corner_key, value)];
+            std::vector<vertex> &out = per_thread[omp_get_thread_num()];
+            for (unsigned char e : tri)
+            {
+                int c0 = table.edge_corner[e][0], c1 = table.edge_corner[e][1];
+                float t = (k_iso_level - value[c0]) / (value[c1] - value[c0]);
+                glm::vec3 x0 = cell_size_ * (glm::vec3(p.x, p.y, p.z) + marching_cubes::corner_position(c0));
+                glm::vec3 x1 = cell_size_ * (glm::vec3(p.x, p.y, p.z) + marching_cubes::corner_position(c1));
+                out.push_back({corner_key[c0] << 2 | e / 4, x0 + std::min(std::max(t, 0.0f), 1.0f) * (x1 - x0)});
+            }
+        }
+        std::vector<vertex> corners = concatenate(per_thread);
+
+        // weld: one vertex per crossed edge
+        std::vector<std::pair<uint64_t, unsigned int>> edge(corners.size());
+        for (unsigned int k = 0; k < corners.size(); k++) edge[k] = {corners[k].edge, k};
+        tbb::parallel_sort(edge.begin(), edge.end());
+        std::vector<unsigned int> vertex_of(corners.size());
+        unsigned int num_vertex = 0;
+        for (unsigned int k = 0; k < edge.size(); k++)
+        {
+            if (k > 0 && edge[k].first != edge[k - 1].first) num_vertex++;
+            vertex_of[edge[k].second] = num_vertex;
+        }
+        if (!edge.empty()) num_vertex++;
+
+        mesh.Clear();
+        mesh.SetNumVertex(num_vertex);
+        mesh.SetNumFaces(corners.size() / 3);
+        for (unsigned int k = 0; k < corners.size(); k++)
+        {
+            const glm::vec3 &x = corners[k].position;
+            mesh.V(vertex_of[k]).Set(x.x, x.y, x.z);
+        }
+        #pragma omp parallel for
+        for (int f = 0; f < (int)corners.size() / 3; f++)
+        {
+            for (int k = 0; k < 3; k++) mesh.F(f).v[k] = vertex_of[3 * f + k];
+        }
+    }
+};
+
+#endif // SURFACE_MESHER_HPP_
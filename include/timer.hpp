@@ -26,6 +26,12 @@ class Timer
         return simulation_time_;
     }
 
+    // resume at simulation_time, next display one refresh interval later
+    void restore(float simulation_time) {
+        simulation_time_   = simulation_time;
+        next_display_time_ = simulation_time_ + refresh_interval_;
+    }
+
     void update_simulation_time() {
         simulation_time_ += k_time_step;
     }
@@ -0,0 +1,241 @@
+#ifndef TRAJECTORY_HPP_
+#define TRAJECTORY_HPP_
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <glm/glm.hpp>
+#include <omp.h>
+
+#include "common.hpp"
+
+// Uncompressed position trajectory for replay.
+//
+// Layout (little-endian):
+//   file_header
+//   { frame_header, glm::vec3 position[frame_header.num_particle] } * n
+// Frames are self-describing so a file cut short by a crash stays readable up to
+// the last complete frame.
+namespace trajectory
+{
+
+const char k_magic[4] = {'S', 'P', 'H', 'T'};
+const uint32_t k_version = 1;
+
+struct file_header
+{
+    char magic[4];
+    uint32_t version;
+    int32_t world_edge_size;
+    uint32_t reserved;
+};
+
+struct frame_header
+{
+    float simulation_time;
+    uint32_t num_particle;
+};
+
+} // namespace trajectory
+
+
+class TrajectoryWriter
+{
+private:
+    int fd_;
+
+public:
+    TrajectoryWriter()
+    : fd_(-1)
+    {
+    };
+
+    bool open(const std::string &path)
+    {
+        if (!is_little_endian())
+        {
+            std::cout << "Trajectories are only supported on little-endian hosts" << std::endl;
+            return false;
+        }
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0)
+        {
+            std::cout << "Failed to open trajectory file: " << path << std::endl;
+            return false;
+        }
+        trajectory::file_header h;
+        std::memcpy(h.magic, trajectory::k_magic, sizeof(h.magic));
+        h.version = trajectory::k_version;
+        h.world_edge_size = k_world_edge_size;
+        h.reserved = 0;
+        return write_all(&h, sizeof(h), NULL, 0);
+    }
+
+    // num_particle world-space positions
+    bool append(const glm::vec3 *position, unsigned int num_particle, float simulation_time)
+    {
+        trajectory::frame_header h = {simulation_time, num_particle};
+        return write_all(&h, sizeof(h), position, num_particle * sizeof(glm::vec3));
+    }
+
+    void close()
+    {
+        if (fd_ < 0) return;
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    ~TrajectoryWriter() { close(); };
+
+private:
+    // header and payload go out in one writev() unless the kernel splits it
+    bool write_all(const void *head, size_t head_bytes, const void *body, size_t body_bytes)
+    {
+        struct iovec iov[2] = {{(void *)head, head_bytes}, {(void *)body, body_bytes}};
+        int iov_index = 0;
+        while (iov_index < 2)
+        {
+            ssize_t n = ::writev(fd_, iov + iov_index, 2 - iov_index);
+            if (n <= 0)
+            {
+                std::cout << "Failed to write trajectory frame" << std::endl;
+                return false;
+            }
+            while (iov_index < 2 && (size_t)n >= iov[iov_index].iov_len)
+            {
+                n -= iov[iov_index].iov_len;
+                iov_index++;
+            }
+            if (iov_index < 2)
+            {
+                iov[iov_index].iov_base = (char *)iov[iov_index].iov_base + n;
+                iov[iov_index].iov_len -= n;
+            }
+        }
+        return true;
+    }
+};
+
+
+// Maps a trajectory file read-only and indexes its frames at open; frame data is
+// read straight from the mapping, so opening is independent of the file size
+// beyond the header walk.
+class TrajectoryReader
+{
+private:
+    const char *map_;
+    size_t size_;
+    trajectory::file_header header_;
+    std::vector<size_t> frame_offset_;
+
+public:
+    TrajectoryReader()
+    : map_(NULL)
+    , size_(0)
+    {
+    };
+
+    bool open(const std::string &path)
+    {
+        if (!is_little_endian())
+        {
+            std::cout << "Trajectories are only supported on little-endian hosts" << std::endl;
+            return false;
+        }
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cout << "Failed to open trajectory file: " << path << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header_))
+        {
+            std::cout << "Invalid trajectory file: " << path << std::endl;
+            ::close(fd);
+            return false;
+        }
+        size_ = st.st_size;
+        void *map = ::mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+        {
+            std::cout << "Failed to map trajectory file: " << path << std::endl;
+            return false;
+        }
+        map_ = static_cast<const char *>(map);
+
+        std::memcpy(&header_, map_, sizeof(header_));
+        if (std::memcmp(header_.magic, trajectory::k_magic, sizeof(header_.magic)) != 0 || header_.version != trajectory::k_version)
+        {
+            std::cout << "Not a version " << trajectory::k_version << " trajectory: " << path << std::endl;
+            close();
+            return false;
+        }
+
+        frame_offset_.clear();
+        size_t offset = sizeof(header_);
+        while (offset + sizeof(trajectory::frame_header) <= size_)
+        {
+            size_t frame_bytes = sizeof(trajectory::frame_header) + get_header_at(offset).num_particle * sizeof(glm::vec3);
+            if (offset + frame_bytes > size_) break;   // incomplete trailing frame
+            frame_offset_.push_back(offset);
+            offset += frame_bytes;
+        }
+        ::madvise((void *)map_, size_, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    unsigned int get_num_frame() const { return frame_offset_.size(); }
+    int get_world_edge_size() const { return header_.world_edge_size; }
+    float get_simulation_time(unsigned int frame) const { return get_header_at(frame_offset_[frame]).simulation_time; }
+    unsigned int get_num_particle(unsigned int frame) const { return get_header_at(frame_offset_[frame]).num_particle; }
+
+    // points into the mapping; valid until close()
+    const glm::vec3 *get_position(unsigned int frame) const
+    {
+        return reinterpret_cast<const glm::vec3 *>(map_ + frame_offset_[frame] + sizeof(trajectory::frame_header));
+    }
+
+    // Same contract as Solver::write_gl_particle_position(); dst holds get_num_particle(frame) elements.
+    void write_gl_particle_position(unsigned int frame, glm::vec3 *dst) const
+    {
+        const glm::vec3 *src = get_position(frame);
+        const int n = get_num_particle(frame);
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+        {
+            glm::vec3 p = src[i];
+            dst[i] = transform_world2gl(p);
+        }
+    }
+
+    void close()
+    {
+        if (map_) ::munmap((void *)map_, size_);
+        map_ = NULL;
+        size_ = 0;
+        frame_offset_.clear();
+    }
+
+    ~TrajectoryReader() { close(); };
+
+private:
+    trajectory::frame_header get_header_at(size_t offset) const
+    {
+        trajectory::frame_header h;
+        std::memcpy(&h, map_ + offset, sizeof(h));
+        return h;
+    }
+};
+
+#endif // TRAJECTORY_HPP_
@@ -0,0 +1,65 @@
+#ifndef TRIPLE_BUFFER_HPP_
+#define TRIPLE_BUFFER_HPP_
+
+#include <atomic>
+
+// Lock-free single-producer / single-consumer handoff of the latest value.
+// The producer always owns one slot, the consumer owns another and the third is
+// exchanged atomically, so neither side ever waits on the other; the consumer
+// simply skips snapshots it was too slow to see.
+template <typename T>
+class TripleBuffer
+{
+private:
+    static const unsigned int k_dirty_bit = 0x4;
+    static const unsigned int k_index_mask = 0x3;
+
+    T buffers_[3];
+    alignas(64) std::atomic<unsigned int> shared_;   // index of the middle slot | k_dirty_bit
+    alignas(64) unsigned int write_index_;
+    alignas(64) unsigned int read_index_;
+
+public:
+    TripleBuffer()
+    : shared_(1)
+    , write_index_(0)
+    , read_index_(2)
+    {
+    };
+
+    // Call once before threads start, e.g. to size vectors.
+    template <typename F>
+    void for_each_buffer(F f)
+    {
+        for (T &b : buffers_) f(b);
+    }
+
+    // Producer side ------------------------------------------------------------//
+    T &get_write_buffer() { return buffers_[write_index_]; }
+
+    void publish()
+    {
+        unsigned int prev = shared_.exchange(write_index_ | k_dirty_bit, std::memory_order_acq_rel);
+        write_index_ = prev & k_index_mask;
+    }
+
+    // Consumer side ------------------------------------------------------------//
+    // Returns true if a newer snapshot became the read buffer.
+    bool update()
+    {
+        if (!(shared_.load(std::memory_order_relaxed) & k_dirty_bit)) return false;
+        unsigned int prev = shared_.exchange(read_index_, std::memory_order_acq_rel);
+        read_index_ = prev & k_index_mask;
+        return true;
+    }
+
+    const T &get_read_buffer() const { return buffers_[read_index_]; }
+
+    // True while a published snapshot has not been taken by update(). A producer that
+    // must not drop snapshots waits for this to clear before publishing again.
+    bool is_pending() const { return shared_.load(std::memory_order_acquire) & k_dirty_bit; }
+
+    ~TripleBuffer() {};
+};
+
+#endif // TRIPLE_BUFFER_HPP_
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <vector>
+#include <string>
 
 #include "glm/glm.hpp"
 #include <cyCodeBase/cyPointCloud.h>
@@ -8,10 +9,52 @@
 #include "common.hpp"
 
 
-int main() 
+// "WxH", both positive; the renderer checks them against GL_MAX_RENDERBUFFER_SIZE
+static bool parse_size(const std::string &value, int &width, int &height)
 {
+    size_t x = value.find('x');
+    int w, h;
+    if (x == std::string::npos || !SimulationConfig::parse_int(value.substr(0, x), w) || !SimulationConfig::parse_int(value.substr(x + 1), h)
+        || w <= 0 || h <= 0) return false;
+    width = w;
+    height = h;
+    return true;
+}
+
+int main(int argc, char **argv) 
+{
+    SimulationConfig config;
+    std::string replay_path;
+    std::string profile_prefix;
+    bool profile_overlay = false;
+    std::string capture_pattern;
+    bool offscreen = false;
+    float lod_pixel = 2.0f;
+    unsigned int render_budget = 1u << 22;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--replay") replay_path = argv[++i];
+        else if (i + 1 < argc && arg == "--profile") profile_prefix = argv[++i];
+        else if (arg == "--profile-overlay") profile_overlay = true;
+        else if (i + 1 < argc && arg == "--capture") capture_pattern = argv[++i];
+        else if (arg == "--offscreen") offscreen = true;
+        else if (i + 1 < argc && arg == "--lod-pixels" && SimulationConfig::parse_float(argv[i + 1], lod_pixel) && lod_pixel >= 0.0f) i++;
+        else if (i + 1 < argc && arg == "--render-budget" && SimulationConfig::parse_unsigned(argv[i + 1], render_budget)) i++;
+        else if (i + 1 < argc && arg == "--size" && parse_size(argv[i + 1], default_src_width, default_src_height)) i++;
+        else if (!config.parse_argument(i, argc, argv))
+        {
+            std::cout << "Usage: " << argv[0] << " [--replay TRAJECTORY] [--profile PREFIX] [--profile-overlay] [--capture PATTERN] [--offscreen] [--size WxH] [--lod-pixels PX] [--render-budget N] [--config FILE] [key=value ...]" << std::endl;
+            return 1;
+        }
+    }
+    if (!apply_simulation_config(config)) return 1;
+
     Renderer renderer;
-    renderer.initialize();
+    renderer.set_profiling(profile_prefix, profile_overlay);
+    renderer.set_capture(capture_pattern, offscreen);
+    renderer.set_level_of_detail(lod_pixel, render_budget);
+    if (!renderer.initialize(replay_path)) return 1;
     renderer.start_looping();
 
 	return 0;
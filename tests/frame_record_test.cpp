@@ -0,0 +1,126 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+#include "common.hpp"
+#include "solver.hpp"
+#include "frame_writer.hpp"
+
+// Round trip of the frame record: runs a small seeded scene, archives every step
+// with FrameWriter (more frames than the queue holds and than the key frame
+// interval), decodes the file with FrameReader and checks every value against the
+// state that was pushed, to within one quantization step. Then checks that a frame
+// of over-long varints is rejected.
+//
+//   g++ -std=c++17 -O2 -fopenmp -I include -I thirdparty/include tests/frame_record_test.cpp -o frame_record_test -ltbb
+//   ./frame_record_test [path]
+int main(int argc, char **argv)
+{
+    const std::string path = argc > 1 ? argv[1] : "frame_record_test.sphf";
+    const unsigned int num_frame = 2 * frame_record::k_keyframe_interval + 5;
+
+    SimulationConfig config;
+    config.num_particle_each_side = 30;
+    config.scene = "dam_break";
+    config.seed = 1;
+    if (!apply_simulation_config(config)) return 1;
+
+    Solver solver;
+    std::vector<FrameReader::frame> expected(num_frame);
+    FrameWriter writer;
+    if (!writer.open(path)) return 1;
+    for (unsigned int f = 0; f < num_frame; f++)
+    {
+        Particle &particles = solver.get_particles();
+        const unsigned int n = particles.get_num_active();
+        expected[f].simulation_time = f * k_time_step;
+        expected[f].position.assign(particles.position.begin(), particles.position.begin() + n);
+        expected[f].velocity.assign(particles.velocity.begin(), particles.velocity.begin() + n);
+        expected[f].density.assign(particles.density.begin(), particles.density.begin() + n);
+        writer.push(particles, expected[f].simulation_time);
+        solver.compute_next_state();
+    }
+    if (!writer.close()) return 1;
+
+    FrameReader reader;
+    if (!reader.open(path)) return 1;
+    FrameReader::frame decoded;
+    unsigned int f = 0;
+    unsigned int num_error = 0;
+    for (; reader.read(decoded); f++)
+    {
+        if (f >= num_frame || decoded.frame_index != f || decoded.position.size() != expected[f].position.size())
+        {
+            std::cout << "frame " << f << ": unexpected header" << std::endl;
+            return 1;
+        }
+        const FrameReader::frame &e = expected[f];
+        float v_max = 0.0f;
+        float d_min = e.density.empty() ? 0.0f : e.density[0];
+        float d_max = d_min;
+        for (unsigned int i = 0; i < e.position.size(); i++)
+        {
+            for (int a = 0; a < 3; a++) v_max = std::max(v_max, std::abs(e.velocity[i][a]));
+            d_min = std::min(d_min, e.density[i]);
+            d_max = std::max(d_max, e.density[i]);
+        }
+        // one quantization step, plus rounding of the float arithmetic
+        const float position_tolerance = 1.01f * k_world_edge_size / 65535.0f;
+        const float velocity_tolerance = 1.01f * 2.0f * v_max / 65535.0f + 1e-6f;
+        const float density_tolerance = 1.01f * (d_max - d_min) / 65535.0f + 1e-3f;
+
+        for (unsigned int i = 0; i < e.position.size(); i++)
+        {
+            bool ok = std::abs(decoded.density[i] - e.density[i]) <= density_tolerance;
+            for (int a = 0; a < 3; a++)
+            {
+                const float p = std::min(std::max(e.position[i][a], 0.0f), (float)k_world_edge_size);
+                ok = ok && std::abs(decoded.position[i][a] - p) <= position_tolerance;
+                ok = ok && std::abs(decoded.velocity[i][a] - e.velocity[i][a]) <= velocity_tolerance;
+            }
+            if (!ok && num_error++ < 10)
+            {
+                std::cout << "frame " << f << ", particle " << i << ": decoded value out of tolerance" << std::endl;
+            }
+        }
+    }
+    reader.close();
+    std::remove(path.c_str());
+
+    if (f != num_frame)
+    {
+        std::cout << "decoded " << f << " of " << num_frame << " frames" << std::endl;
+        return 1;
+    }
+    if (num_error > 0)
+    {
+        std::cout << num_error << " values out of tolerance" << std::endl;
+        return 1;
+    }
+    std::cout << "frame record round trip: " << num_frame << " frames OK" << std::endl;
+
+    // one particle, every byte a continuation byte
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        frame_record::file_header fh = {{'S', 'P', 'H', 'F'}, frame_record::k_version, 1, k_world_edge_size, frame_record::k_keyframe_interval};
+        frame_record::frame_header h = {0, 1, 0.0f, 1.0f, 0.0f, 1.0f, 1, frame_record::k_num_channel * frame_record::k_max_varint_bytes};
+        std::vector<char> payload(h.payload_bytes, (char)0xff);
+        file.write(reinterpret_cast<const char *>(&fh), sizeof(fh));
+        file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        file.write(payload.data(), payload.size());
+    }
+    FrameReader corrupt;
+    const bool rejected = corrupt.open(path) && !corrupt.read(decoded);
+    corrupt.close();
+    std::remove(path.c_str());
+    if (!rejected)
+    {
+        std::cout << "corrupt frame was not rejected" << std::endl;
+        return 1;
+    }
+    std::cout << "corrupt frame rejected" << std::endl;
+    return 0;
+}
@@ -176,6 +176,17 @@ public:
 		GetPoints( target_index, position, r2, pointFound, 1 );
 	}
 
+	//! Same as above, with the original callback form that has no target index
+	//! (used by cySampleElim.h and the closest point methods):
+	//!
+	//! void _CALLBACK(SIZE_TYPE index, PointType const &p, FType distanceSquared, FType &radiusSquared)
+	template <typename _CALLBACK>
+	void GetPoints( PointType const &position, FType radius, _CALLBACK pointFound ) const
+	{
+		FType r2 = radius*radius;
+		GetPoints( 0, position, r2, [&pointFound]( SIZE_TYPE, SIZE_TYPE i, PointType const &p, FType d2, FType &radiusSquared ) { pointFound( i, p, d2, radiusSquared ); }, 1 );
+	}
+
 	//! Used by one of the PointCloud::GetPoints() methods.
 	//!
 	//! Keeps the point index, position, and distance squared to a given search position.